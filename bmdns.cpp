@@ -0,0 +1,341 @@
+/*******************************************************************************
+ * file: /github:elhernes/libmdns/bmdns.cpp
+ *
+ * born-on: Sun Oct 18 2026
+ * creator: Eric L. Hernes
+ *
+ * Parser benchmark: replays a synthetic corpus of typical responses through
+ * each layer of the receive path and reports packets/s, records/s and heap
+ * allocations per packet
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "mdns.h"
+#include "mdns_c.h"
+#include "mdns_cache.h"
+
+#include <algorithm>  // for find
+#include <chrono>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+// every operator new in the process lands here, so a stage's allocations are
+// the difference in the count across its run
+static uint64_t s_allocs=0;
+
+void *
+operator new(size_t n) {
+    s_allocs++;
+    void *p = malloc(n ? n : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void
+operator delete(void *p) noexcept {
+    free(p);
+}
+
+void
+operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+static const char *skProg=0;
+static void usage();
+
+using Packet = std::vector<uint8_t>;
+
+struct Corpus {
+    const char *name;
+    const char *desc;
+    std::vector<Packet> (*build)();
+};
+
+namespace {
+    using clock = std::chrono::steady_clock;
+
+    void
+    addPacket(std::vector<Packet> &v, mdns_writer_t &w) {
+        size_t n = mdns_writer_finish(&w);
+        v.emplace_back(w.buffer, w.buffer+n);
+    }
+
+    // answers to a _services._dns-sd._udp.local. PTR query from several hosts
+    std::vector<Packet>
+    discoveryBurst() {
+        static const char *types[] = {
+            "_http._tcp.local.", "_ssh._tcp.local.", "_sftp-ssh._tcp.local.", "_smb._tcp.local.",
+            "_afpovertcp._tcp.local.", "_device-info._tcp.local.", "_ipp._tcp.local.", "_printer._tcp.local.",
+            "_airplay._tcp.local.", "_raop._tcp.local.", "_googlecast._tcp.local.", "_spotify-connect._tcp.local.",
+        };
+        const char *sd = "_services._dns-sd._udp.local.";
+        std::vector<Packet> v;
+        uint8_t buffer[MDNS_PACKET_MTU];
+        for(unsigned host=0; host<16; host++) {
+            mdns_writer_t w;
+            mdns_writer_init(&w, buffer, sizeof(buffer), 0, 0x8400);
+            for(unsigned t=0; t<4+host%8; t++) {
+                const char *type = types[(host+t)%(sizeof(types)/sizeof(types[0]))];
+                mdns_writer_ptr(&w, mdns_entrytype::ANSWER, sd, strlen(sd), 1, 4500, type, strlen(type));
+            }
+            addPacket(v, w);
+        }
+        return v;
+    }
+
+    // printers announcing _ipp._tcp with a full RFC 6763 / IPP Everywhere TXT record
+    std::vector<Packet>
+    txtPrinters() {
+        static const char *skTxt[][2] = {
+            { "txtvers", "1" }, { "qtotal", "1" }, { "rp", "ipp/print" }, { "ty", "ACME LaserJet 4000 Series" },
+            { "adminurl", "http://printer.local./hp/device/info_config_AirPrint.html?tab=Networking" },
+            { "note", "Second floor, by the kitchen" }, { "priority", "0" },
+            { "product", "(ACME LaserJet 4000 Series)" },
+            { "pdl", "application/octet-stream,application/pdf,application/postscript,image/jpeg,image/png,image/pwg-raster,image/urf" },
+            { "Color", "T" }, { "Duplex", "T" }, { "Fax", "F" }, { "Scan", "T" }, { "Copies", "T" },
+            { "Collate", "T" }, { "Bind", "F" }, { "Punch", "F" }, { "Sort", "F" }, { "Staple", "F" },
+            { "PaperMax", "legal-A4" }, { "kind", "document,envelope,photo" },
+            { "URF", "CP1,IS1-5-7,MT1-2-3-4-5-8-9-10-11-12-14,OB10,PQ3-4-5,RS600,SRGB24,V1.4,W8,DM1" },
+            { "UUID", "564e4333-4230-3431-3533-186024e7c4b4" }, { "TLS", "1.2" },
+            { "mopria-certified", "1.3" }, { "usb_MFG", "ACME" }, { "usb_MDL", "LaserJet 4000 Series" },
+            { "usb_CMD", "PJL,PCL,PCLXL,POSTSCRIPT,PDF,PWGRASTER,URF" }, { "air", "username,password" },
+        };
+        const size_t ntxt = sizeof(skTxt)/sizeof(skTxt[0]);
+        mdns_record_txt_t txt[ntxt];
+        for(size_t i=0; i<ntxt; i++) {
+            txt[i].key.str = skTxt[i][0];
+            txt[i].key.length = strlen(skTxt[i][0]);
+            txt[i].value.str = skTxt[i][1];
+            txt[i].value.length = strlen(skTxt[i][1]);
+        }
+        const char *type = "_ipp._tcp.local.";
+        std::vector<Packet> v;
+        uint8_t buffer[MDNS_PACKET_MTU];
+        for(unsigned p=0; p<16; p++) {
+            char instance[64], host[64];
+            snprintf(instance, sizeof(instance), "ACME LaserJet 4000 [%06X]._ipp._tcp.local.", 0x1e4c00+p);
+            snprintf(host, sizeof(host), "acme-%06x.local.", 0x1e4c00+p);
+            struct in_addr a;
+            a.s_addr = htonl(0xc0a80100 + 10 + p);
+            struct in6_addr a6;
+            inet_pton(AF_INET6, "fe80::1a60:24ff:fee7:c4b4", &a6);
+            a6.s6_addr[15] = (uint8_t)p;
+
+            mdns_writer_t w;
+            mdns_writer_init(&w, buffer, sizeof(buffer), 0, 0x8400);
+            mdns_writer_ptr(&w, mdns_entrytype::ANSWER, type, strlen(type), 1, 4500, instance, strlen(instance));
+            mdns_writer_txt(&w, mdns_entrytype::ADDITIONAL, instance, strlen(instance), 0x8001, 4500, txt, ntxt);
+            mdns_writer_srv(&w, mdns_entrytype::ADDITIONAL, instance, strlen(instance), 0x8001, 120,
+                            0, 0, 631, host, strlen(host));
+            mdns_writer_a(&w, mdns_entrytype::ADDITIONAL, host, strlen(host), 0x8001, 120, &a);
+            mdns_writer_aaaa(&w, mdns_entrytype::ADDITIONAL, host, strlen(host), 0x8001, 120, &a6);
+            addPacket(v, w);
+        }
+        return v;
+    }
+
+    // many instances and subtypes under shared suffixes, so nearly every name is
+    // a label or two followed by a compression pointer
+    std::vector<Packet>
+    pointerHeavy() {
+        std::vector<Packet> v;
+        uint8_t buffer[MDNS_PACKET_MTU];
+        for(unsigned p=0; p<16; p++) {
+            mdns_writer_t w;
+            mdns_writer_init(&w, buffer, sizeof(buffer), 0, 0x8400);
+            for(unsigned i=0; i<24; i++) {
+                char type[96], instance[128], host[64];
+                snprintf(type, sizeof(type), "_sub%u._sub._node%u._tcp.site%u.example.local.", i%3, p%4, p%2);
+                snprintf(instance, sizeof(instance), "node-%u-%u.%s", p, i, type);
+                snprintf(host, sizeof(host), "n%u-%u.site%u.example.local.", p, i, p%2);
+                if (mdns_writer_ptr(&w, mdns_entrytype::ANSWER, type, strlen(type), 1, 4500,
+                                    instance, strlen(instance)) ||
+                    mdns_writer_srv(&w, mdns_entrytype::ANSWER, instance, strlen(instance), 0x8001, 120,
+                                    0, 0, 9000+i, host, strlen(host))) {
+                    break;
+                }
+            }
+            addPacket(v, w);
+        }
+        return v;
+    }
+
+    const Corpus skCorpora[] = {
+        { "discovery", "service enumeration answers", discoveryBurst },
+        { "printers", "TXT-heavy _ipp._tcp announcements", txtPrinters },
+        { "pointers", "compression-pointer-heavy PTR/SRV", pointerHeavy },
+    };
+
+    // exposes the record decoders to the benchmark
+    class BenchRR : public MdnsRR {
+     public:
+        using MdnsRR::MdnsRR;
+        using MdnsRR::onMdnsRecord;
+        using MdnsRR::onMdnsRecordView;
+    };
+
+    struct sockaddr_in
+    sourceAddr() {
+        struct sockaddr_in from;
+        memset(&from, 0, sizeof(from));
+        from.sin_family = AF_INET;
+        from.sin_port = htons(5353);
+        from.sin_addr.s_addr = htonl(0xc0a80101);
+        return from;
+    }
+
+    // run one pass over the corpus per call of fn until secs have elapsed
+    void
+    bench(const char *corpus, const char *stage, const std::vector<Packet> &packets, double secs,
+          const std::function<size_t(const Packet &)> &fn) {
+        size_t records=0;
+        uint64_t npackets=0;
+        fn(packets[0]); // warm up caches and arenas
+        uint64_t allocs0 = s_allocs;
+        auto t0 = clock::now();
+        double dt = 0;
+        do {
+            for(auto &p : packets) {
+                records += fn(p);
+            }
+            npackets += packets.size();
+            dt = std::chrono::duration<double>(clock::now() - t0).count();
+        } while (dt < secs);
+        uint64_t allocs = s_allocs - allocs0;
+        printf("%-10s %-8s %12.0f %12.0f %10.2f %8.1f\n", corpus, stage,
+               npackets/dt, records/dt, (double)allocs/npackets, 1e9*dt/npackets);
+    }
+}
+
+int
+main(int ac, char **av) {
+    skProg = av[0];
+    double secs = 0.5;
+    int ch;
+    while ((ch = getopt(ac, av, "t:h")) != -1) {
+        switch (ch) {
+        case 't':
+            secs = atof(optarg);
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+    std::vector<std::string> only(av+optind, av+ac);
+
+    BenchRR rr;
+    struct sockaddr_in from = sourceAddr();
+    const struct sockaddr *saddr = (const struct sockaddr*)&from;
+
+    printf("%-10s %-8s %12s %12s %10s %8s\n", "corpus", "stage", "packets/s", "records/s", "allocs/pkt", "ns/pkt");
+    for(auto &c : skCorpora) {
+        if (!only.empty() && std::find(only.begin(), only.end(), c.name)==only.end()) {
+            continue;
+        }
+        std::vector<Packet> packets = c.build();
+        size_t bytes=0;
+        for(auto &p : packets) bytes += p.size();
+        printf("# %s: %s, %zu packets, %zu bytes avg\n", c.name, c.desc, packets.size(), bytes/packets.size());
+
+        // names only: the mdns_records_parse/mdns_string_extract walk with a no-op callback,
+        // inlined, then through the std::function entry point
+        auto none = [](const struct sockaddr*, mdns_string_t &, mdns_entrytype, uint16_t,
+                       uint16_t, uint32_t, const uint8_t*, size_t, size_t, size_t)->int {
+            return 0;
+        };
+        bench(c.name, "parse", packets, secs, [&](const Packet &p) {
+                return mdns_packet_parse(saddr, 0, p.data(), p.size(), none);
+            });
+        mdns_record_callback_fn noneFn = none;
+        bench(c.name, "parse-fn", packets, secs, [&](const Packet &p) {
+                return mdns_packet_parse(saddr, 0, p.data(), p.size(), noneFn);
+            });
+
+        // decoding into an arena-backed batch
+        MdnsRecordBatch batch;
+        auto view = [&](const struct sockaddr* from, mdns_string_t &question,
+                                           mdns_entrytype entry, uint16_t type, uint16_t rclass, uint32_t ttl,
+                                           const uint8_t* data, size_t size, size_t offset, size_t length)->int {
+            return BenchRR::onMdnsRecordView(batch, from, question, entry, type, rclass, ttl,
+                                             data, size, offset, length);
+        };
+        bench(c.name, "view", packets, secs, [&](const Packet &p) {
+                batch.clear();
+                return mdns_packet_parse(saddr, 0, p.data(), p.size(), view);
+            });
+
+        // the same, typed rdata only: no address or TXT formatting
+        MdnsRecordBatch typed;
+        typed.text = false;
+        auto typedView = [&](const struct sockaddr* from, mdns_string_t &question,
+                             mdns_entrytype entry, uint16_t type, uint16_t rclass, uint32_t ttl,
+                             const uint8_t* data, size_t size, size_t offset, size_t length)->int {
+            return BenchRR::onMdnsRecordView(typed, from, question, entry, type, rclass, ttl,
+                                             data, size, offset, length);
+        };
+        bench(c.name, "typed", packets, secs, [&](const Packet &p) {
+                typed.clear();
+                return mdns_packet_parse(saddr, 0, p.data(), p.size(), typedView);
+            });
+
+        // decoding into owning MdnsRecords, as responses(std::vector<MdnsRecord>&) hands them out
+        std::vector<MdnsRecord> records;
+        auto record = [&](const struct sockaddr* from, mdns_string_t &question,
+                                             mdns_entrytype entry, uint16_t type, uint16_t rclass, uint32_t ttl,
+                                             const uint8_t* data, size_t size, size_t offset, size_t length)->int {
+            records.emplace_back();
+            return BenchRR::onMdnsRecord(records.back(), from, question, entry, type, rclass, ttl,
+                                         data, size, offset, length);
+        };
+        bench(c.name, "record", packets, secs, [&](const Packet &p) {
+                records.clear();
+                return mdns_packet_parse(saddr, 0, p.data(), p.size(), record);
+            });
+
+        // the whole receive path: decode, then refresh the cache
+        bench(c.name, "rr", packets, secs, [&](const Packet &p) {
+                batch.clear();
+                return rr.parse(saddr, p.data(), p.size(), batch);
+            });
+    }
+    return 0;
+}
+
+static void
+usage() {
+    printf("usage: %s [-t seconds] [corpus ...]\n", skProg);
+    printf("\ncorpora:\n");
+    for(auto &c : skCorpora) {
+        printf(" %-10s %s\n", c.name, c.desc);
+    }
+    printf("\nstages:\n");
+    printf(" parse      mdns_packet_parse with a no-op callback\n");
+    printf(" parse-fn   the same through an mdns_record_callback_fn (std::function)\n");
+    printf(" view       records decoded into an MdnsRecordBatch\n");
+    printf(" typed      the same with text off: typed rdata only\n");
+    printf(" record     records decoded into MdnsRecords\n");
+    printf(" rr         MdnsRR::parse: decode and cache\n");
+}
+
+/*
+ * Local Variables:
+ * mode: C++
+ * mode: font-lock
+ * c-basic-offset: 4
+ * tab-width: 8
+ * compile-command: "make.rmk MK=bmdns.mk"
+ * End:
+ */
+
+/* end of /github:elhernes/libmdns/bmdns.cpp */
@@ -0,0 +1,26 @@
+########################################
+## file: /github:elhernes/libmdns/bmdns.mk
+## born-on: Sun Oct 18 2026
+## creator: Elh
+##
+## Makefile to build the parser benchmark
+##
+
+PROG=bmdns
+SRCS=bmdns.cpp
+
+CXXFLAGS-dey=-pthread
+LDFLAGS-dey=-pthread
+
+LIBS=mdns
+
+include sw.prog.mk
+
+#
+# Local Variables:
+# mode: Makefile
+# mode: font-lock
+# tab-width: 8
+# compile-command: "make.rmk MK=bmdns.mk"
+# End:
+#
@@ -6,7 +6,7 @@
 ## Makefile to build something
 ##
 
-SRCS=mdns_c.cpp mdns.cpp
+SRCS=mdns_c.cpp mdns.cpp mdns_cache.cpp mdns_loop.cpp mdns_metrics.cpp mdns_responder.cpp mdns_scheduler.cpp mdns_service.cpp
 
 DEFINES+=
 
@@ -15,199 +15,800 @@
 #include <sys/socket.h>
 
 #include <net/if.h>
+#include <ifaddrs.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
-#include <netdb.h>
-#include <poll.h>
-#include <sys/time.h>
 
 #include "mdns.h"
 #include "mdns_c.h"  // for MDNS_STRING_FORMAT, mdns_string_t, mdns_discover...
+#include "mdns_cache.h"
+#include "mdns_loop.h"
+#include "mdns_scheduler.h"
 
-#include <iomanip>
-#include <sstream>
+#include <string.h>  // for memcpy
 
+#include <algorithm>  // for find
 
-MdnsRR::MdnsRR(const std::string &netif) : m_tid(1) { // tid=0 for discovery
-    m_4sock = mdns_socket_open_ipv6();
-    m_6sock = mdns_socket_open_ipv4();
+namespace {
+    // m_pending's key: the type's two bytes, then the name as MdnsCache::key() has it
+    std::string_view pendingKey(uint16_t type, const char *name, size_t length, char *buf, size_t capacity) {
+        buf[0] = (char)(type >> 8);
+        buf[1] = (char)type;
+        mdns_string_t k = mdns_string_key(name, length, buf+2, capacity-2);
+        return std::string_view(buf, 2 + k.length);
+    }
+}
+
+const int MdnsRR::kAnswerWindowMs;
+
+MdnsRR::MdnsRR(const std::string &netif, unsigned rxBatch, MdnsLoop *loop) {
+    init(rxBatch, loop);
     if (netif.size()>0) {
-        unsigned ifindex = if_nametoindex(netif.c_str());
-        printf("%s: index %d\n", netif.c_str(), ifindex);
-        if (setsockopt(m_6sock, IPPROTO_IPV6, IPV6_MULTICAST_IF, &ifindex, sizeof(ifindex))) {
-            perror("setsockopt: IPV6_MULTICAST_IF");
+        openInterface(netif);
+    } else {
+        openInterface("", 0);
+    }
+}
+
+MdnsRR::MdnsRR(const std::vector<std::string> &netifs, unsigned rxBatch, MdnsLoop *loop) {
+    init(rxBatch, loop);
+    for(auto &n : netifs.size()>0 ? netifs : systemInterfaces()) {
+        openInterface(n);
+    }
+}
+
+MdnsRR::MdnsRR(NoInterfaces, unsigned rxBatch, MdnsLoop *loop) {
+    init(rxBatch, loop);
+}
+
+void
+MdnsRR::init(unsigned rxBatch, MdnsLoop *loop) {
+    m_tid = 1; // tid=0 for discovery
+    m_rxring = new mdns_rxring_t;
+    m_txring = new mdns_txring_t;
+    mdns_txring_clear(m_txring);
+    m_group4len = mdns_multicast_group(AF_INET, &m_group4);
+    m_group6len = mdns_multicast_group(AF_INET6, &m_group6);
+    m_rxStats = MdnsRxStats();
+    m_rxIfindex = 0;
+    m_rxStamp = 0;
+    m_npending = 0;
+    m_cache.reset(new MdnsCache);
+    if (!loop) {
+        m_ownLoop.reset(new MdnsLoop);
+        loop = m_ownLoop.get();
+    }
+    m_loop = loop;
+    m_scheduler.reset(new MdnsScheduler(*m_loop, *m_cache, [this](const std::vector<MdnsQuestion> &questions) {
+                return query(questions);
+            }));
+    m_rxBatch = nullptr;
+    m_rxQueue = nullptr;
+    m_rxSlot = nullptr;
+    m_rxStop = false;
+    m_nextSub = 1;
+    if (mdns_rxring_init(m_rxring, rxBatch>0 ? rxBatch : MDNS_RX_BATCH, 2048)) {
+        perror("mdns_rxring_init");
+    }
+}
+
+bool
+MdnsRR::openInterface(const std::string &netif) {
+    unsigned ifindex = if_nametoindex(netif.c_str());
+    if (ifindex==0) {
+        perror(netif.c_str());
+        return false;
+    }
+    return openInterface(netif, ifindex);
+}
+
+// one socket pair per interface, joined and sending on that interface only
+bool
+MdnsRR::openInterface(const std::string &netif, unsigned ifindex) {
+    MdnsInterface mi = { netif, ifindex, mdns_socket_open_ipv4_if(ifindex), mdns_socket_open_ipv6_if(ifindex) };
+    if (mi.sock4<0 && mi.sock6<0) {
+        fprintf(stderr, "%s: no mdns sockets\n", netif.c_str());
+        return false;
+    }
+    for(int fd : { mi.sock4, mi.sock6 }) {
+        m_metrics.sockets.emplace_back();
+        MdnsSocketMetrics *sm = &m_metrics.sockets.back();
+        if (fd>=0) m_loop->add(fd, [this, sm](int fd, unsigned) { onReadable(fd, *sm); });
+    }
+    m_ifs.push_back(mi);
+    return true;
+}
+
+bool
+MdnsRR::setSocketBuffers(int rcvbuf, int sndbuf) {
+    bool rv=true;
+    for(auto &mi : m_ifs) {
+        for(int fd : { mi.sock4, mi.sock6 }) {
+            if (fd>=0 && mdns_socket_buffers(fd, rcvbuf, sndbuf)) {
+                perror("mdns_socket_buffers");
+                rv=false;
+            }
         }
-        if (setsockopt(m_4sock, IPPROTO_IP, IP_MULTICAST_IF, &ifindex, sizeof(ifindex))) {
-            perror("setsockopt: IP_MULTICAST_IF");
+    }
+    return rv;
+}
+
+std::vector<std::string>
+MdnsRR::systemInterfaces() {
+    std::vector<std::string> v;
+    struct ifaddrs *ifa0;
+    if (getifaddrs(&ifa0)==0) {
+        for(struct ifaddrs *ifa=ifa0; ifa; ifa=ifa->ifa_next) {
+            unsigned flags = ifa->ifa_flags;
+            if ((flags & IFF_UP) && (flags & IFF_MULTICAST) && !(flags & IFF_LOOPBACK) &&
+                std::find(v.begin(), v.end(), ifa->ifa_name) == v.end()) {
+                v.push_back(ifa->ifa_name);
+            }
         }
+        freeifaddrs(ifa0);
     }
+    return v;
 }
 
 MdnsRR::~MdnsRR() {
-    if (m_4sock>=0) mdns_socket_close(m_4sock);
-    if (m_6sock>=0) mdns_socket_close(m_6sock);
+    stop();
+    m_scheduler.reset(); // cancels its timer, so before a private loop goes
+    for(auto &mi : m_ifs) {
+        for(int fd : { mi.sock4, mi.sock6 }) {
+            if (fd>=0) {
+                m_loop->remove(fd);
+                mdns_socket_close(fd);
+            }
+        }
+    }
+    mdns_rxring_free(m_rxring);
+    delete m_rxring;
+    delete m_txring;
 }
 
 
 bool
 MdnsRR::discover() {
-    bool rv=false;
-    if (m_4sock>=0) rv|=mdns_discovery_send(m_4sock)==0;
-    if (m_6sock>=0) rv|=mdns_discovery_send(m_6sock)==0;
+    std::lock_guard<std::mutex> lock(m_txMutex);
+    mdns_txring_clear(m_txring);
+    mdns_txring_discovery(m_txring);
     m_tid=0;
-    return rv;
+    return sendTx();
 }
 
 bool
 MdnsRR::query(mdns_recordtype type, const std::string &name) {
-    bool rv=false;
+    mdns_query_t q = { type, name.c_str(), name.size() };
+    std::lock_guard<std::mutex> lock(m_txMutex);
+    return sendQuery(&q, 1);
+}
+
+bool
+MdnsRR::query(const std::vector<MdnsQuestion> &questions) {
+    std::lock_guard<std::mutex> lock(m_txMutex);
+    m_txQueries.clear();
+    for(auto &q : questions) {
+        m_txQueries.push_back({ q.type, q.name.c_str(), q.name.size() });
+    }
+    return sendQuery(m_txQueries.data(), m_txQueries.size());
+}
+
+// build the query, with known answers, once and send it on every socket; m_txMutex held
+bool
+MdnsRR::sendQuery(const mdns_query_t *questions, size_t count) {
+    knownAnswers(questions, count);
+    questionsSent(questions, count, mdns_time_ns());
     m_tid++;
-    if (m_4sock>=0) rv|=mdns_query_send(m_4sock, m_tid, type, name)==0;
-    if (m_6sock>=0) rv|=mdns_query_send(m_6sock, m_tid, type, name)==0;
+    mdns_txring_clear(m_txring);
+    if (mdns_txring_query(m_txring, m_tid, questions, count, m_txKnown.data(), m_txKnown.size()) < 0) {
+        // more known answers than one burst holds: let the stateless sender split it up
+        // (packets are counted, their bytes are not)
+        bool rv=false;
+        for(size_t i=0; i<m_ifs.size(); i++) {
+            const MdnsInterface &mi = m_ifs[i];
+            for(int f=0; f<2; f++) {
+                int fd = f ? mi.sock6 : mi.sock4;
+                if (fd<0) continue;
+                int sent = mdns_multiquery_send_known(fd, m_tid, questions, count,
+                                                      m_txKnown.data(), m_txKnown.size());
+                if (sent>0) {
+                    m_metrics.sockets[2*i+f].txPackets.add(sent);
+                    rv = true;
+                }
+            }
+        }
+        return rv;
+    }
+    return sendTx();
+}
+
+// m_txring to every socket, one sendmmsg each; m_txMutex held
+bool
+MdnsRR::sendTx() {
+    bool rv=false;
+    for(size_t i=0; i<m_ifs.size(); i++) {
+        const MdnsInterface &mi = m_ifs[i];
+        for(int f=0; f<2; f++) {
+            int fd = f ? mi.sock6 : mi.sock4;
+            if (fd<0) continue;
+            int sent = f ? mdns_txring_send(fd, m_txring, (const struct sockaddr*)&m_group6, m_group6len)
+                         : mdns_txring_send(fd, m_txring, (const struct sockaddr*)&m_group4, m_group4len);
+            if (sent>0) {
+                MdnsSocketMetrics &sm = m_metrics.sockets[2*i+f];
+                size_t bytes=0;
+                for(int p=0; p<sent; p++) bytes += m_txring->lengths[p];
+                sm.txPackets.add(sent);
+                sm.txBytes.add(bytes);
+                rv = true;
+            }
+        }
+    }
+    return rv;
+}
+
+// RFC 6762 section 7.1: list cached answers with more than half their TTL left into
+// m_txKnown. Their rdata is copied into m_txRdata, which the records point into, so a
+// receive thread may keep updating the cache meanwhile. m_txMutex held.
+void
+MdnsRR::knownAnswers(const mdns_query_t *questions, size_t count) {
+    auto now = MdnsCache::clock::now();
+    m_txKnown.clear();
+    m_txOffsets.clear();
+    m_txRdata.clear();
+    for(size_t i=0; i<count; i++) {
+        const mdns_query_t &q = questions[i];
+        m_cache->visit(q.type, std::string_view(q.name, q.length), [&](const MdnsCache::Entry &e) {
+                auto left = std::chrono::duration_cast<std::chrono::seconds>(e.expires - now).count();
+                if (2*left > (long long)e.ttl) {
+                    m_txOffsets.push_back(m_txRdata.size());
+                    m_txRdata += e.rdata;
+                    m_txKnown.push_back({ q.name, q.length, e.rtype, e.rclass, (uint32_t)left,
+                                          nullptr, e.rdata.size() });
+                }
+            }, now);
+    }
+    for(size_t i=0; i<m_txKnown.size(); i++) {
+        m_txKnown[i].rdata = (const uint8_t*)m_txRdata.data() + m_txOffsets[i];
+    }
+}
+
+// start timing the answers to questions about to be sent; m_txMutex held
+void
+MdnsRR::questionsSent(const mdns_query_t *questions, size_t count, uint64_t sent) {
+    char buf[258];
+    std::lock_guard<std::mutex> lock(m_pendMutex);
+    closeQuestions(sent);
+    for(size_t i=0; i<count; i++) {
+        std::string_view k = pendingKey(questions[i].type, questions[i].name, questions[i].length, buf, sizeof(buf));
+        auto pi = m_pending.find(k);
+        if (pi == m_pending.end()) {
+            m_pending.emplace(std::string(k), Pending{ sent, 0 });
+            continue;
+        }
+        // asked again: the earlier one's answers are in
+        if (pi->second.last) m_metrics.lastAnswerNs.observe(pi->second.last - pi->second.sent);
+        pi->second = Pending{ sent, 0 };
+    }
+    m_npending.store(m_pending.size(), std::memory_order_relaxed);
+}
+
+// an answer for (type, name) got to this host at arrival; receiving thread
+void
+MdnsRR::answerArrived(uint16_t type, const mdns_string_t &name, uint64_t arrival) {
+    char buf[258];
+    std::string_view k = pendingKey(type, name.str, name.length, buf, sizeof(buf));
+    std::lock_guard<std::mutex> lock(m_pendMutex);
+    auto pi = m_pending.find(k);
+    if (pi == m_pending.end()) {
+        return;
+    }
+    Pending &p = pi->second;
+    // before the question went out: an answer to someone else's; after the window: unsolicited
+    if (arrival < p.sent || arrival - p.sent > (uint64_t)kAnswerWindowMs*1000000) {
+        return;
+    }
+    if (!p.last) m_metrics.firstAnswerNs.observe(arrival - p.sent);
+    if (arrival > p.last) p.last = arrival;
+}
+
+// questions whose window has passed by now: their last answer is in; m_pendMutex held
+void
+MdnsRR::closeQuestions(uint64_t now) {
+    for(auto pi=m_pending.begin(); pi!=m_pending.end(); ) {
+        const Pending &p = pi->second;
+        if (now - p.sent <= (uint64_t)kAnswerWindowMs*1000000 || now < p.sent) {
+            ++pi;
+            continue;
+        }
+        if (p.last) m_metrics.lastAnswerNs.observe(p.last - p.sent);
+        pi = m_pending.erase(pi);
+    }
+    m_npending.store(m_pending.size(), std::memory_order_relaxed);
+}
+
+void
+MdnsRR::expireQuestions() {
+    if (m_npending.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(m_pendMutex);
+        closeQuestions(mdns_time_ns());
+    }
+}
+
+bool
+MdnsRR::responses(MdnsRecordBatch &batch, int ms) {
+    size_t n0 = batch.records.size();
+    m_cache->expire();
+    m_rxBatch = &batch;
+    m_loop->runUntil(MdnsLoop::clock::now() + std::chrono::milliseconds(ms));
+    m_rxBatch = nullptr;
+    expireQuestions();
+    return batch.records.size()>n0;
+}
+
+int
+MdnsRR::collectRecord(MdnsRecordBatch &batch, const struct sockaddr* from, mdns_string_t &question,
+                      mdns_entrytype entry, uint16_t type, uint16_t rclass, uint32_t ttl,
+                      const uint8_t* data, size_t size, size_t offset, size_t length) {
+    int rv = onMdnsRecordView(batch, from, question, entry, type, rclass, ttl, data, size, offset, length);
+    batch.records.back().ifindex = m_rxIfindex;
+    batch.records.back().received = m_rxStamp;
+    cacheRecord(batch.records.back(), rclass, ttl, data, size, offset, length);
+    m_scheduler->onRecord(batch.records.back().rtype, batch.records.back().question);
+    if (m_subsNow) {
+        dispatch(batch.records.back());
+    }
     return rv;
 }
 
+void
+MdnsRR::cacheRecord(const MdnsRecordView &rv, uint16_t rclass, uint32_t ttl,
+                    const uint8_t* data, size_t size, size_t offset, size_t length) {
+    uint8_t rdata[512];
+    size_t rdlen = mdns_record_rdata_expand(data, size, offset, length, rv.rtype, rdata, sizeof(rdata));
+    if (rdlen>0 || length==0) {
+        m_cache->insert(rv, rclass, ttl, std::string_view((const char*)rdata, rdlen));
+    }
+}
+
+bool
+MdnsRR::lookup(mdns_recordtype type, const std::string &name, std::vector<MdnsRecord> &v) {
+    return m_cache->lookup(type, name, v)>0;
+}
+
+bool
+MdnsRR::resolve(mdns_recordtype type, const std::string &name, std::vector<MdnsRecord> &v, int msec) {
+    if (lookup(type, name, v)) {
+        return true;
+    }
+    if (!query(type, name)) {
+        return false;
+    }
+    std::vector<MdnsRecord> rsp;
+    responses(rsp, msec);
+    return lookup(type, name, v);
+}
+
 bool
 MdnsRR::responses(std::vector<MdnsRecord> &v, int ms) {
-    bool rv=true;
-    if (rv) {
-        rv = waitForReplies(ms, [&](const struct sockaddr* from, mdns_string_t &question, mdns_entrytype entry,
-                                    uint16_t type, uint16_t rclass, uint32_t ttl, const uint8_t* data, size_t size,
-                                    size_t offset, size_t length)->int {
-                                MdnsRecord rr;
-                                auto rv= onMdnsRecord(rr, from, question, entry, type, rclass, ttl,
-                                                      data, size, offset, length);
-                                v.push_back(rr);
-                                return rv;
-                            });
+    MdnsRecordBatch batch;
+    responses(batch, ms);
+    v.reserve(v.size() + batch.records.size());
+    for(auto &rv : batch.records) {
+        v.emplace_back(rv);
     }
     return v.size()>0;
 }
 
 bool
 MdnsRR::waitForReplies(int msec, mdns_record_callback_fn cb) {
+    m_rxCallback = cb;
+    bool rv = m_loop->runUntil(MdnsLoop::clock::now() + std::chrono::milliseconds(msec));
+    m_rxCallback = nullptr;
+    expireQuestions();
+    return rv;
+}
+
+bool
+MdnsRR::receive(MdnsRecordQueue &queue, const std::atomic<bool> &stop) {
+    m_rxQueue = &queue;
+    bool rv = runReceiver(stop, 100); // how long a stop request may go unnoticed
+    m_rxQueue = nullptr;
+    return rv;
+}
+
+// the receive thread body: dispatch until stop, sleeping no longer than the next cache
+// expiry, and at most msec (-1: until a wakeup) between looks at stop
+bool
+MdnsRR::runReceiver(const std::atomic<bool> &stop, int msec) {
     bool rv=true;
-    struct timeval t0, t1;
-    int et = 0;
-    gettimeofday(&t0, nullptr);
-
-    for(;et<msec;) {
-        struct pollfd fds[] = {
-            { .fd = m_4sock, .events=POLLIN, .revents=0 },
-            { .fd = m_6sock, .events=POLLIN, .revents=0 }
-        };
-        int nfd = poll(fds, sizeof(fds)/sizeof(fds[0]), msec-et);
-        switch (nfd) {
-        case -1:
-            // error
-            break;
-        case 0:
-            // timeout
-            break;
+    while (rv && !stop.load(std::memory_order_acquire)) {
+        int wait = msec;
+        auto next = m_cache->nextExpiry();
+        if (next != MdnsCache::clock::time_point::max()) {
+            auto dt = std::chrono::duration_cast<std::chrono::milliseconds>(
+                next - MdnsCache::clock::now()).count() + 1;
+            if (dt<0) dt=0;
+            if (wait<0 || dt<wait) wait=(int)dt;
+        }
+        rv = m_loop->runOnce(wait);
+        m_cache->expire();
+        expireQuestions();
+    }
+    if (!rv) {
+        perror("MdnsRR::receive");
+    }
+    return rv;
+}
 
-        default:
-            for(unsigned i=0; i<sizeof(fds)/sizeof(fds[0]); i++) {
-                if((fds[i].revents & POLLIN)!=0) {
-                    uint8_t rxbuffer[2048];
-                    mdns_recv(fds[i].fd, m_tid, rxbuffer, sizeof(rxbuffer), cb);
-                }
+bool
+MdnsRR::continuousQuery(mdns_recordtype type, const std::string &name) {
+    return m_scheduler->add(type, name);
+}
+
+bool
+MdnsRR::cancelQuery(mdns_recordtype type, const std::string &name) {
+    return m_scheduler->remove(type, name);
+}
+
+void
+MdnsRR::writeMetrics(std::string &out) const {
+    MdnsMetricsText text(out);
+    auto socketLabels = [](const MdnsInterface &mi, int f) {
+        return MdnsMetricsText::label("interface", mi.name) + "," +
+            MdnsMetricsText::label("family", f ? "ipv6" : "ipv4");
+    };
+    static const struct {
+        const char *name;
+        const char *help;
+        MdnsCounter MdnsSocketMetrics::*counter;
+    } skSocket[] = {
+        { "mdns_rx_packets_total", "Datagrams received.", &MdnsSocketMetrics::rxPackets },
+        { "mdns_rx_bytes_total", "Bytes received.", &MdnsSocketMetrics::rxBytes },
+        { "mdns_rx_kernel_drops_total", "Datagrams the kernel dropped with the receive buffer full.",
+          &MdnsSocketMetrics::rxDrops },
+        { "mdns_tx_packets_total", "Datagrams sent.", &MdnsSocketMetrics::txPackets },
+        { "mdns_tx_bytes_total", "Bytes sent.", &MdnsSocketMetrics::txBytes },
+    };
+    for(auto &m : skSocket) {
+        text.family(m.name, "counter", m.help);
+        for(size_t i=0; i<m_ifs.size(); i++) {
+            for(int f=0; f<2; f++) {
+                if ((f ? m_ifs[i].sock6 : m_ifs[i].sock4) < 0) continue;
+                text.sample(m.name, socketLabels(m_ifs[i], f), (m_metrics.sockets[2*i+f].*m.counter).value());
             }
-            break;
         }
-        gettimeofday(&t1, nullptr);
-        et = ((t1.tv_sec - t0.tv_sec) * 1000) + ((t1.tv_usec - t0.tv_usec) / 1000); // in ms
     }
-    return rv;
+
+    static const struct {
+        const char *name;
+        const char *help;
+    } skBuffer[] = {
+        { "mdns_socket_receive_buffer_bytes", "SO_RCVBUF as granted." },
+        { "mdns_socket_send_buffer_bytes", "SO_SNDBUF as granted." },
+    };
+    for(int b=0; b<2; b++) {
+        text.family(skBuffer[b].name, "gauge", skBuffer[b].help);
+        for(size_t i=0; i<m_ifs.size(); i++) {
+            for(int f=0; f<2; f++) {
+                int fd = f ? m_ifs[i].sock6 : m_ifs[i].sock4;
+                int size[2] = { 0, 0 };
+                if (fd<0 || mdns_socket_buffers_get(fd, &size[0], &size[1])) continue;
+                text.sample(skBuffer[b].name, socketLabels(m_ifs[i], f), (uint64_t)size[b]);
+            }
+        }
+    }
+
+    text.family("mdns_rx_dropped_total", "counter", "Datagrams not parsed, by reason.");
+    text.sample("mdns_rx_dropped_total", "reason=\"not_response\"", m_metrics.rejected.value());
+    text.sample("mdns_rx_dropped_total", "reason=\"truncated\"", m_metrics.truncated.value());
+    text.sample("mdns_rx_dropped_total", "reason=\"malformed\"", m_metrics.malformed.value());
+
+    text.family("mdns_records_total", "counter", "Resource records parsed, by section.");
+    text.sample("mdns_records_total", "section=\"answer\"", m_metrics.records[0].value());
+    text.sample("mdns_records_total", "section=\"authority\"", m_metrics.records[1].value());
+    text.sample("mdns_records_total", "section=\"additional\"", m_metrics.records[2].value());
+
+    text.histogram("mdns_callback_seconds", "Time spent in each subscriber or record callback call.",
+                   m_metrics.callbackNs, 1e-9);
+    text.histogram("mdns_rx_delay_seconds", "From a datagram's kernel arrival until it is parsed.",
+                   m_metrics.rxDelayNs, 1e-9);
+    text.histogram("mdns_first_answer_seconds", "From sending a question to its first answer's kernel arrival.",
+                   m_metrics.firstAnswerNs, 1e-9);
+    text.histogram("mdns_last_answer_seconds", "From sending a question to its last answer's kernel arrival.",
+                   m_metrics.lastAnswerNs, 1e-9);
+
+    text.family("mdns_cache_lookups_total", "counter", "Record cache lookups, by result.");
+    text.sample("mdns_cache_lookups_total", "result=\"hit\"", m_cache->hits());
+    text.sample("mdns_cache_lookups_total", "result=\"miss\"", m_cache->misses());
+    text.family("mdns_cache_entries", "gauge", "Records in the cache.");
+    text.sample("mdns_cache_entries", std::string(), m_cache->size());
+
+    text.family("mdns_continuous_query_packets_total", "counter", "Packets sent by the continuous query scheduler.");
+    text.sample("mdns_continuous_query_packets_total", std::string(), m_scheduler->packets());
+    text.family("mdns_continuous_query_questions_total", "counter", "Questions in them.");
+    text.sample("mdns_continuous_query_questions_total", std::string(), m_scheduler->questions());
 }
 
-mdns_string_t
-ipv4_address_to_string(char* buffer, size_t capacity, const struct sockaddr_in* addr) {
-	char host[NI_MAXHOST] = {0};
-	char service[NI_MAXSERV] = {0};
-	int ret = getnameinfo((const struct sockaddr*)addr, sizeof(struct sockaddr_in),
-	                      host, NI_MAXHOST, service, NI_MAXSERV,
-	                      NI_NUMERICSERV | NI_NUMERICHOST);
-	size_t len = 0;
-	if (ret == 0) {
-#if 0
-		if (addr->sin_port != 0)
-			len = snprintf(buffer, capacity, "%s:%s", host, service);
-		else
-#endif
-			len = snprintf(buffer, capacity, "%s", host);
-	}
-	if (len >= capacity)
-		len = (int)capacity - 1;
-	mdns_string_t str = {buffer, len};
-	return str;
-}
-
-mdns_string_t
-ipv6_address_to_string(char* buffer, size_t capacity, const struct sockaddr_in6* addr) {
-	char host[NI_MAXHOST] = {0};
-	char service[NI_MAXSERV] = {0};
-	int ret = getnameinfo((const struct sockaddr*)addr, sizeof(struct sockaddr_in6),
-	                      host, NI_MAXHOST, service, NI_MAXSERV,
-	                      NI_NUMERICSERV | NI_NUMERICHOST);
-	size_t len = 0;
-	if (ret == 0) {
-#if 0
-		if (addr->sin6_port != 0)
-			len = snprintf(buffer, capacity, "[%s]:%s", host, service);
-		else
-#endif
-			len = snprintf(buffer, capacity, "%s", host);
-	}
-	if (len >= capacity)
-		len = (int)capacity - 1;
-	mdns_string_t str = {buffer, len};
-	return str;
+bool
+MdnsRR::start() {
+    if (m_rxThread.joinable() || !m_ownLoop) {
+        return false;
+    }
+    m_rxStop = false;
+    m_rxThread = std::thread([this]() {
+            runReceiver(m_rxStop, -1); // stop() wakes the loop
+        });
+    return true;
 }
 
-mdns_string_t
-ip_address_to_string(char* buffer, size_t capacity, const struct sockaddr* addr) {
-	if (addr->sa_family == AF_INET6)
-		return ipv6_address_to_string(buffer, capacity, (const struct sockaddr_in6*)addr);
-	return ipv4_address_to_string(buffer, capacity, (const struct sockaddr_in*)addr);
+void
+MdnsRR::stop() {
+    if (!m_rxThread.joinable()) {
+        return;
+    }
+    m_rxStop = true;
+    if (std::this_thread::get_id() == m_rxThread.get_id()) {
+        return; // from a subscriber: the thread ends after this wakeup, joined later
+    }
+    m_loop->wakeup();
+    m_rxThread.join();
 }
 
-#define MDNS_STD_STRING(ms) std::string(ms.str,ms.length)
+uint64_t
+MdnsRR::subscribe(const std::string &name, mdns_recordtype type, MdnsSubscriber cb) {
+    std::lock_guard<std::mutex> lock(m_subMutex);
+    auto subs = m_subs ? std::make_shared<Subscriptions>(*m_subs) : std::make_shared<Subscriptions>();
+    uint64_t id = m_nextSub++;
+    subs->push_back({ id, name.empty() ? std::string() : MdnsCache::key(name), type, cb });
+    m_subs = subs;
+    return id;
+}
+
+bool
+MdnsRR::unsubscribe(uint64_t id) {
+    std::lock_guard<std::mutex> lock(m_subMutex);
+    if (!m_subs) {
+        return false;
+    }
+    auto subs = std::make_shared<Subscriptions>(*m_subs);
+    auto si = std::find_if(subs->begin(), subs->end(), [id](const Subscription &s) { return s.id==id; });
+    if (si == subs->end()) {
+        return false;
+    }
+    subs->erase(si);
+    m_subs = subs->empty() ? nullptr : subs;
+    return true;
+}
+
+void
+MdnsRR::dispatch(const MdnsRecordView &rv) {
+    char buf[256];
+    mdns_string_t key = { nullptr, 0 };
+    for(auto &sub : *m_subsNow) {
+        if (sub.type != mdns_recordtype::IGNORE && sub.type != rv.rtype) {
+            continue;
+        }
+        if (!sub.key.empty()) {
+            if (!key.str) {
+                key = mdns_string_key(rv.question.data(), rv.question.size(), buf, sizeof(buf));
+            }
+            if (sub.key != std::string_view(key.str, key.length)) {
+                continue;
+            }
+        }
+        auto t0 = std::chrono::steady_clock::now();
+        sub.cb(rv);
+        m_metrics.callbackNs.observe(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                         std::chrono::steady_clock::now() - t0).count());
+    }
+}
+
+// loop handler for both sockets: drain up to a ring's worth, then parse the batch.
+// Outside responses() and receive() (e.g. while another instance drives a shared
+// loop) the records still go into the cache.
+void
+MdnsRR::onReadable(int fd, MdnsSocketMetrics &sm) {
+    if (m_rxQueue) {
+        m_rxSlot = m_rxQueue->prepare();
+        if (m_rxSlot) m_rxSlot->clear();
+    }
+    // into responses()' batch, else the receive() queue slot, else the cache only
+    MdnsRecordBatch &batch = m_rxBatch ? *m_rxBatch : m_rxSlot ? *m_rxSlot : m_idle;
+    uint64_t arrival = 0;  // of the packet being parsed: the kernel's stamp, else when read
+    auto collect = [this, &batch, &arrival](const struct sockaddr* from, mdns_string_t &question,
+                                            mdns_entrytype entry, uint16_t type, uint16_t rclass, uint32_t ttl,
+                                            const uint8_t* data, size_t size, size_t offset, size_t length)->int {
+        if (m_npending.load(std::memory_order_relaxed)) answerArrived(type, question, arrival);
+        return collectRecord(batch, from, question, entry, type, rclass, ttl, data, size, offset, length);
+    };
+    // waitForReplies()' callback, timed like the subscribers
+    auto timed = [this, &arrival](const struct sockaddr* from, mdns_string_t &question, mdns_entrytype entry,
+                                  uint16_t type, uint16_t rclass, uint32_t ttl, const uint8_t* data,
+                                  size_t size, size_t offset, size_t length)->int {
+        if (m_npending.load(std::memory_order_relaxed)) answerArrived(type, question, arrival);
+        auto t0 = std::chrono::steady_clock::now();
+        int rv = m_rxCallback(from, question, entry, type, rclass, ttl, data, size, offset, length);
+        m_metrics.callbackNs.observe(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                         std::chrono::steady_clock::now() - t0).count());
+        return rv;
+    };
+    size_t n = mdns_recv_batch(fd, m_rxring);
+    uint64_t now = n ? mdns_time_ns() : 0;
+    size_t bytes=0;
+    for(size_t p=0; p<n; p++) {
+        const struct sockaddr *from = (const struct sockaddr*)&m_rxring->addrs[p];
+        const uint8_t *buffer = m_rxring->buffers + p*m_rxring->capacity;
+        uint64_t stamp = m_rxring->stamps[p];
+        bytes += m_rxring->lengths[p];
+        if (stamp && now >= stamp) m_metrics.rxDelayNs.observe(now - stamp);
+        arrival = stamp ? stamp : now;
+        if (m_rxCallback) {
+            parsePacket(from, buffer, m_rxring->lengths[p], m_rxring->ifindex[p], stamp, timed, nullptr);
+        } else {
+            parsePacket(from, buffer, m_rxring->lengths[p], m_rxring->ifindex[p], stamp, collect, nullptr);
+        }
+    }
+    if (m_rxQueue) {
+        if (!m_rxSlot) {
+            m_rxQueue->drop(m_idle.records.size());
+        } else if (!m_rxSlot->records.empty()) {
+            m_rxQueue->commit();
+        }
+        m_rxSlot = nullptr;
+    }
+    m_idle.clear();
+    sm.rxPackets.add(n);
+    sm.rxBytes.add(bytes);
+    if (m_rxring->drops) {
+        sm.rxDrops.add((uint32_t)(m_rxring->drops - sm.lastDrops)); // modulo 2^32, as the kernel's
+        sm.lastDrops = m_rxring->drops;
+    }
+    m_rxStats.wakeups++;
+    m_rxStats.packets += n;
+    m_rxStats.last = n;
+    if (n > m_rxStats.max) m_rxStats.max = n;
+}
+
+size_t
+MdnsRR::onPacket(const struct sockaddr *from, const uint8_t *buffer, size_t size, unsigned ifindex,
+                 const mdns_record_callback_fn &cb, mdns_parse_status *status) {
+    return parsePacket(from, buffer, size, ifindex, 0, cb, status);
+}
+
+template<typename F>
+size_t
+MdnsRR::parsePacket(const struct sockaddr *from, const uint8_t *buffer, size_t size, unsigned ifindex,
+                    uint64_t stamp, F &&cb, mdns_parse_status *status) {
+    mdns_parse_status st;
+    m_rxIfindex = ifindex;
+    m_rxStamp = stamp;
+    {
+        std::lock_guard<std::mutex> lock(m_subMutex);
+        m_subsNow = m_subs;
+    }
+    size_t sections[3];
+    size_t n = mdns_packet_parse<F>(from, m_tid, buffer, size, std::forward<F>(cb), &st, sections);
+    m_subsNow.reset();
+    for(int i=0; i<3; i++) {
+        if (sections[i]) m_metrics.records[i].add(sections[i]);
+    }
+    if (st == mdns_parse_status::NOT_RESPONSE) {
+        m_rxStats.rejected++;
+        m_metrics.rejected.add();
+    } else if (st != mdns_parse_status::OK) {
+        m_rxStats.malformed++;
+        (st == mdns_parse_status::TRUNCATED ? m_metrics.truncated : m_metrics.malformed).add();
+    }
+    if (status) *status = st;
+    return n;
+}
+
+size_t
+MdnsRR::parse(const struct sockaddr *from, const uint8_t *buffer, size_t size, MdnsRecordBatch &batch,
+              unsigned ifindex, mdns_parse_status *status) {
+    return parsePacket(from, buffer, size, ifindex, 0,
+                       [this, &batch](const struct sockaddr* from, mdns_string_t &question, mdns_entrytype entry,
+                                      uint16_t type, uint16_t rclass, uint32_t ttl, const uint8_t* data,
+                                      size_t size, size_t offset, size_t length)->int {
+                           return collectRecord(batch, from, question, entry, type, rclass, ttl,
+                                                data, size, offset, length);
+                       }, status);
+}
+
+MdnsArena::MdnsArena(size_t blockSize) : m_blockSize(blockSize), m_block(0), m_used(0) {
+}
+
+char *
+MdnsArena::alloc(size_t n, size_t align) {
+    while (m_block < m_blocks.size()) {
+        Block &b = m_blocks[m_block];
+        size_t at = (m_used + align-1) & ~(align-1); // blocks start out max-aligned
+        if (at + n <= b.size) {
+            char *p = b.mem.get() + at;
+            m_used = at + n;
+            return p;
+        }
+        m_block++;
+        m_used = 0;
+    }
+    size_t bsz = n > m_blockSize ? n : m_blockSize;
+    m_blocks.push_back({ std::unique_ptr<char[]>(new char[bsz]), bsz });
+    m_block = m_blocks.size()-1;
+    m_used = n;
+    return m_blocks.back().mem.get();
+}
+
+std::string_view
+MdnsArena::copy(const char *s, size_t n) {
+    char *p = alloc(n);
+    memcpy(p, s, n);
+    return std::string_view(p, n);
+}
+
+void
+MdnsArena::clear() {
+    m_block = 0;
+    m_used = 0;
+}
+
+#define MDNS_STRING_VIEW(ms) std::string_view(ms.str,ms.length)
 
 int
-MdnsRR::onMdnsRecord(MdnsRecord &rr,
-                     const struct sockaddr* from, mdns_string_t &question, mdns_entrytype entry, uint16_t type,
-                     uint16_t rclass, uint32_t ttl, const uint8_t* data, size_t size, size_t offset, size_t length) {
-    rr.question = MDNS_STD_STRING(question);
+MdnsRR::onMdnsRecordView(MdnsRecordBatch &batch,
+                         const struct sockaddr* from, mdns_string_t &question, mdns_entrytype entry, uint16_t type,
+                         uint16_t rclass, uint32_t ttl, const uint8_t* data, size_t size, size_t offset, size_t length) {
+    MdnsArena &arena = batch.arena;
+    batch.records.emplace_back();
+    MdnsRecordView &rr = batch.records.back();
+    rr.question = arena.copy(question.str, question.length);
 
-    char addrbuffer[64];
     char namebuffer[256];
     mdns_record_txt_t txtbuffer[128];
 
-    mdns_string_t fromaddrstr = ip_address_to_string(addrbuffer, sizeof(addrbuffer), from);
-    rr.ip = fromaddrstr.str;
+    // a datagram's records share its source: format it once, and reuse the slice
+    rr.from = MdnsEndpoint(from);
+    if (!batch.ip.data() || rr.from != batch.from) {
+        char addrbuffer[MdnsEndpoint::kMaxText];
+        batch.from = rr.from;
+        batch.ip = arena.copy(addrbuffer, rr.from.format(addrbuffer));
+    }
+    rr.ip = batch.ip;
     rr.etype = (mdns_entry::type)entry;
     rr.rtype = (mdns_record::type)type;
+    rr.ifindex = 0;
+    if (offset+length > size) {
+        length = offset<size ? size-offset : 0;
+    }
 
+    // the typed form first; the text form is made from it, names shared
     switch (type) {
     case mdns_recordtype::PTR: {
 		mdns_string_t namestr = mdns_record_parse_ptr(data, size, offset, length,
 		                                              namebuffer, sizeof(namebuffer));
-        rr.data = MDNS_STD_STRING(namestr);
+        rr.rdata.name = arena.copy(namestr.str, namestr.length);
+        rr.data = rr.rdata.name;
 	}
         break;
 
     case mdns_recordtype::SRV: {
 		mdns_record_srv_t srv = mdns_record_parse_srv(data, size, offset, length,
 		                                              namebuffer, sizeof(namebuffer));
-        rr.data = MDNS_STD_STRING(srv.name);
+        rr.rdata.srv.priority = srv.priority;
+        rr.rdata.srv.weight = srv.weight;
+        rr.rdata.srv.port = srv.port;
+        rr.rdata.name = arena.copy(srv.name.str, srv.name.length);
+        rr.data = rr.rdata.name;
 	}
         break;
         
     case mdns_recordtype::A: {
 		struct sockaddr_in addr;
 		mdns_record_parse_a(data, size, offset, length, &addr);
-		mdns_string_t addrstr = ipv4_address_to_string(namebuffer, sizeof(namebuffer), &addr);
-        rr.data = MDNS_STD_STRING(addrstr);
+        rr.rdata.a = addr.sin_addr;
+        if (batch.text) {
+            size_t n = mdns_format_ipv4((const uint8_t*)&addr.sin_addr, namebuffer);
+            rr.data = arena.copy(namebuffer, n);
+        }
 	}
         break;
 
@@ -215,42 +816,83 @@ MdnsRR::onMdnsRecord(MdnsRecord &rr,
 		struct sockaddr_in6 addr;
         mdns_string_t name;
 		mdns_record_parse_aaaa(data, size, offset, length, &name, &addr);
-		mdns_string_t addrstr = ipv6_address_to_string(namebuffer, sizeof(namebuffer), &addr);
-        rr.data = MDNS_STD_STRING(name) + "=";
-        rr.data += MDNS_STD_STRING(addrstr);
+        rr.rdata.aaaa = addr.sin6_addr;
+        if (batch.text) {
+            size_t n = mdns_format_ipv6((const uint8_t*)&addr.sin6_addr, namebuffer);
+            char *p = arena.alloc(name.length + 1 + n);
+            rr.data = std::string_view(p, name.length + 1 + n);
+            memcpy(p, name.str, name.length); p += name.length;
+            *p++ = '=';
+            memcpy(p, namebuffer, n);
+        }
 	}
         break;
         
     case mdns_recordtype::TXT: {
-		size_t parsed = mdns_record_parse_txt(data, size, offset, length,
+        // parse the arena's copy of the rdata so the attributes can point into it
+        std::string_view raw = arena.copy((const char*)data + offset, length);
+		size_t parsed = mdns_record_parse_txt((const uint8_t*)raw.data(), raw.size(), 0, raw.size(),
 		                                      txtbuffer, sizeof(txtbuffer) / sizeof(mdns_record_txt_t));
-        rr.data = "";
+        MdnsTxtView *txt = (MdnsTxtView*)arena.alloc(parsed*sizeof(MdnsTxtView), alignof(MdnsTxtView));
+        for (size_t itxt = 0; itxt < parsed; ++itxt) {
+            txt[itxt].key = MDNS_STRING_VIEW(txtbuffer[itxt].key);
+            txt[itxt].value = MDNS_STRING_VIEW(txtbuffer[itxt].value);
+        }
+        rr.rdata.txt = txt;
+        rr.rdata.ntxt = parsed;
+        if (!batch.text) {
+            break;
+        }
+        // size it first so the joined "k=v; " string is a single arena allocation
+        size_t n = 0;
 		for (size_t itxt = 0; itxt < parsed; ++itxt) {
-			if (txtbuffer[itxt].value.length) {
-                rr.data += MDNS_STD_STRING(txtbuffer[itxt].key);
-                rr.data += "=";
-                rr.data += MDNS_STD_STRING(txtbuffer[itxt].value);
-			}
-			else {
-                rr.data += MDNS_STD_STRING(txtbuffer[itxt].key);
+            n += txt[itxt].key.size() + 2;
+			if (!txt[itxt].value.empty()) {
+                n += 1 + txt[itxt].value.size();
+            }
+        }
+        char *p = arena.alloc(n);
+        rr.data = std::string_view(p, n);
+		for (size_t itxt = 0; itxt < parsed; ++itxt) {
+            memcpy(p, txt[itxt].key.data(), txt[itxt].key.size());
+            p += txt[itxt].key.size();
+			if (!txt[itxt].value.empty()) {
+                *p++ = '=';
+                memcpy(p, txt[itxt].value.data(), txt[itxt].value.size());
+                p += txt[itxt].value.size();
 			}
-            rr.data += "; ";
+            *p++ = ';';
+            *p++ = ' ';
 		}
 	}
         break;
         
     default: {
-        std::stringstream ss;
-        ss << std::hex;
-        for(unsigned i=0; i<length; i++) {
-            ss << data[offset+i];
+        static const char skHex[] = "0123456789abcdef";
+        rr.rdata.bytes = arena.copy((const char*)data + offset, length);
+        if (batch.text) {
+            char *p = arena.alloc(2*length);
+            rr.data = std::string_view(p, 2*length);
+            for(unsigned i=0; i<length; i++) {
+                *p++ = skHex[data[offset+i] >> 4];
+                *p++ = skHex[data[offset+i] & 0xf];
+            }
         }
-        rr.data = ss.str();
 	}
     }
     return 0;
 }
 
+int
+MdnsRR::onMdnsRecord(MdnsRecord &rr,
+                     const struct sockaddr* from, mdns_string_t &question, mdns_entrytype entry, uint16_t type,
+                     uint16_t rclass, uint32_t ttl, const uint8_t* data, size_t size, size_t offset, size_t length) {
+    MdnsRecordBatch batch;
+    int rv = onMdnsRecordView(batch, from, question, entry, type, rclass, ttl, data, size, offset, length);
+    rr = MdnsRecord(batch.records.back());
+    return rv;
+}
+
 /*
  * Local Variables:
  * mode: C++
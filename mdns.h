@@ -12,11 +12,23 @@
 
 #include <stddef.h>    // for size_t
 #include <stdint.h>    // for uint16_t, uint8_t, uint32_t
+#include <sys/socket.h>  // for socklen_t
+#include <netinet/in.h>  // for sockaddr_in6
+#include <atomic>
 #include <functional>  // for function
 #include <iosfwd>      // for string
+#include <map>
+#include <memory>      // for unique_ptr, shared_ptr
+#include <mutex>
 #include <string>      // for basic_string
+#include <string_view>
+#include <thread>
 #include <vector>
 
+#include "mdns_endpoint.h"
+#include "mdns_metrics.h"
+#include "mdns_spsc.h"
+
 namespace mdns_record {
     enum type {
         IGNORE = 0,
@@ -43,37 +55,303 @@ namespace mdns_entry {
 }
 using mdns_entrytype = mdns_entry::type;
 
+// why mdns_packet_parse stopped
+namespace mdns_parse {
+    enum status {
+        OK = 0,
+        NOT_RESPONSE = 1,  // a query, or nonzero opcode/rcode (RFC 6762 section 18)
+        TRUNCATED = 2,     // a section runs past the end of the message
+        MALFORMED = 3      // bad name or compression pointer
+    };
+}
+using mdns_parse_status = mdns_parse::status;
+
+// Bump allocator for the strings of an MdnsRecordBatch; clear() keeps the blocks for reuse
+class MdnsArena {
+ public:
+    MdnsArena(size_t blockSize=16*1024);
+
+    char *alloc(size_t n, size_t align=1); // align: a power of two
+    std::string_view copy(const char *s, size_t n);
+    void clear();
+
+ private:
+    struct Block {
+        std::unique_ptr<char[]> mem;
+        size_t size;
+    };
+    size_t m_blockSize;
+    std::vector<Block> m_blocks;
+    size_t m_block;
+    size_t m_used;
+};
+
+// one TXT attribute; a boolean attribute ("key" with no '=') has an empty value
+struct MdnsTxtView {
+    std::string_view key;
+    std::string_view value;
+};
+
+struct MdnsSrv {
+    uint16_t priority;
+    uint16_t weight;
+    uint16_t port;
+};
+
+// rdata decoded by type straight from mdns_record_parse_*, without formatting; the
+// field for rtype is set, and the slices share the record's arena
+struct MdnsRecordData {
+    MdnsRecordData() : aaaa(), txt(nullptr), ntxt(0) {}
+
+    union {
+        struct in_addr a;       // A, network order
+        struct in6_addr aaaa;   // AAAA
+        MdnsSrv srv;            // SRV, host order
+    };
+    std::string_view name;      // PTR and SRV target
+    const MdnsTxtView *txt;     // TXT: ntxt attributes
+    size_t ntxt;
+    std::string_view bytes;     // any other type: the rdata as received
+};
+
+// MdnsRecord whose strings are slices of an MdnsRecordBatch arena
+struct MdnsRecordView {
+    std::string_view question;
+    mdns_entry::type etype;
+    mdns_record::type rtype;
+    std::string_view ip;    // from, as text; shared by every record from the same sender
+    std::string_view data;  // text form; empty when the batch is not keeping text
+    unsigned ifindex;   // receiving interface, 0 if unknown
+    uint64_t received;  // kernel arrival, mdns_time_ns() clock; 0 if not reported
+    MdnsEndpoint from;
+    MdnsRecordData rdata;
+};
+
+// views are valid until the batch is cleared or destroyed
+struct MdnsRecordBatch {
+    MdnsArena arena;
+    std::vector<MdnsRecordView> records;
+    // false: skip formatting data, for consumers of rdata only; cache entries first
+    // heard this way have no text either
+    bool text = true;
+    // the sender last formatted into the arena, for the records that follow from it
+    MdnsEndpoint from;
+    std::string_view ip;
+
+    void clear() { records.clear(); arena.clear(); ip = std::string_view(); }
+};
+
+// record batches from a receive thread to one consumer, see MdnsRR::receive()
+using MdnsRecordQueue = MdnsSpsc<MdnsRecordBatch>;
+
+// subscription callback; the view is valid only for the duration of the call
+using MdnsSubscriber = std::function<void(const MdnsRecordView &rec)>;
+
 struct MdnsRecord {
+    MdnsRecord() = default;
+    explicit MdnsRecord(const MdnsRecordView &v)
+        : question(v.question), etype(v.etype), rtype(v.rtype), ip(v.ip), data(v.data), ifindex(v.ifindex),
+          received(v.received), from(v.from) {}
+
     std::string question;
     mdns_entry::type etype;
     mdns_record::type rtype;
     std::string ip;
     std::string data;
+    unsigned ifindex = 0;
+    uint64_t received = 0;
+    MdnsEndpoint from;
+};
+
+struct MdnsQuestion {
+    mdns_record::type type;
+    std::string name;
+};
+
+// socket pair joined on one interface
+struct MdnsInterface {
+    std::string name;
+    unsigned ifindex;  // 0: system default
+    int sock4;
+    int sock6;
+};
+
+// receive batching counters, see MdnsRR::rxStats()
+struct MdnsRxStats {
+    uint64_t wakeups;  // socket readiness events
+    uint64_t packets;  // datagrams delivered to the parser
+    unsigned last;     // datagrams delivered by the most recent wakeup
+    unsigned max;      // most datagrams delivered by a single wakeup
+    uint64_t rejected; // datagrams that were not responses
+    uint64_t malformed;// truncated or malformed responses
 };
 
+class MdnsCache;
+class MdnsLoop;
+class MdnsScheduler;
+
 using mdns_record_callback_fn = std::function<int(const struct sockaddr* from, struct mdns_string_t &question,
                                                   mdns_entrytype entry, uint16_t type,
                                                   uint16_t rclass, uint32_t ttl, const uint8_t* data,
                                                   size_t size, size_t offset, size_t length)>;
 class MdnsRR {
  public:
-    MdnsRR(const std::string &netif="");
+    // answers arriving this long after their question was sent are not timed, see
+    // MdnsMetrics::firstAnswerNs
+    static const int kAnswerWindowMs = 1000;
+
+    // loop: event loop to register with, e.g. MdnsLoop::shared(); nullptr for a private one
+    MdnsRR(const std::string &netif="", unsigned rxBatch=0, MdnsLoop *loop=nullptr);
+    // one socket pair per interface; an empty list means every multicast capable interface
+    MdnsRR(const std::vector<std::string> &netifs, unsigned rxBatch=0, MdnsLoop *loop=nullptr);
+    // no sockets at all, for feeding parse() from elsewhere, e.g. a capture file
+    struct NoInterfaces {};
+    explicit MdnsRR(NoInterfaces, unsigned rxBatch=0, MdnsLoop *loop=nullptr);
     virtual ~MdnsRR();
 
     bool discover();
     bool query(mdns_recordtype type, const std::string &name);
+    bool query(const std::vector<MdnsQuestion> &questions); // packed, name-compressed
     bool responses(std::vector<MdnsRecord> &v, int msec);
+    bool responses(MdnsRecordBatch &batch, int msec); // appends views; no per-record allocation
+
+    // own a receive thread that keeps the cache current and feeds the subscriptions;
+    // while it runs, do not call responses() or resolve(). Only with a private loop: a
+    // shared one (MdnsLoop is not thread safe) is driven by whoever owns it, so false.
+    bool start();
+    void stop();
+    bool running() const { return m_rxThread.joinable(); }
+
+    // deliver each record for name (any name if empty) and type (any if IGNORE) to cb as soon
+    // as it is parsed, on the thread running the loop. Any thread may (un)subscribe; cb may
+    // still be running, or about to run once more, when unsubscribe() returns.
+    uint64_t subscribe(const std::string &name, mdns_recordtype type, MdnsSubscriber cb);
+    bool unsubscribe(uint64_t id);
+
+    // run the receive loop on the calling (dedicated) thread until stop is set. Each
+    // wakeup's records are filled into the next free queue slot as one batch; when the
+    // consumer has fallen behind they are dropped and counted (queue.drops(), in records)
+    // rather than waited for. The cache is updated either way. Other threads may query()
+    // and use the cache meanwhile, but not responses() or resolve().
+    bool receive(MdnsRecordQueue &queue, const std::atomic<bool> &stop);
+
+    // feed one message received elsewhere (a capture, another thread's socket) through the
+    // same path as the sockets: records go into the cache and are appended to batch
+    size_t parse(const struct sockaddr *from, const uint8_t *buffer, size_t size, MdnsRecordBatch &batch,
+                 unsigned ifindex=0, mdns_parse_status *status=nullptr);
+
+    // answer from the record cache only; true on a hit
+    bool lookup(mdns_recordtype type, const std::string &name, std::vector<MdnsRecord> &v);
+    // cache first, otherwise query and wait up to msec for answers
+    bool resolve(mdns_recordtype type, const std::string &name, std::vector<MdnsRecord> &v, int msec);
+
+    // RFC 6762 section 5.2 continuous query: sent shortly, then 1, 2, 4 ... s apart up to an
+    // hour, and again at 80/85/90/95% of each cached answer's TTL; questions falling due
+    // together share a packet. Needs the loop running, e.g. start().
+    bool continuousQuery(mdns_recordtype type, const std::string &name);
+    bool cancelQuery(mdns_recordtype type, const std::string &name);
+
+    MdnsCache &cache() { return *m_cache; }
+    MdnsScheduler &scheduler() { return *m_scheduler; }
+
+    const MdnsRxStats &rxStats() const { return m_rxStats; }
+    // safe to read from any thread while receiving; writeMetrics() appends them, with the
+    // cache and continuous query counters, in Prometheus text format
+    const MdnsMetrics &metrics() const { return m_metrics; }
+    void writeMetrics(std::string &out) const;
+    MdnsLoop &loop() { return *m_loop; }
+    const std::vector<MdnsInterface> &interfaces() const { return m_ifs; }
+
+    static std::vector<std::string> systemInterfaces(); // up, multicast, not loopback
+
+    // SO_RCVBUF/SO_SNDBUF for every socket, in bytes (0: leave as is). A burst of answers
+    // larger than the receive buffer is dropped by the kernel: see MdnsSocketMetrics::rxDrops.
+    bool setSocketBuffers(int rcvbuf, int sndbuf=0);
 
 protected:
+    void init(unsigned rxBatch, MdnsLoop *loop);
+    bool openInterface(const std::string &netif);
+    bool openInterface(const std::string &netif, unsigned ifindex);
     bool waitForReplies(int msec, mdns_record_callback_fn cb);
+    void onReadable(int fd, MdnsSocketMetrics &sm);
+    size_t onPacket(const struct sockaddr *from, const uint8_t *buffer, size_t size, unsigned ifindex,
+                    const mdns_record_callback_fn &cb, mdns_parse_status *status);
+    // onPacket with the record handler inlined into the parser; defined in mdns.cpp
+    template<typename F>
+    size_t parsePacket(const struct sockaddr *from, const uint8_t *buffer, size_t size, unsigned ifindex,
+                       uint64_t stamp, F &&cb, mdns_parse_status *status);
     static int onMdnsRecord(MdnsRecord &rr, const struct sockaddr* from, mdns_string_t &question, mdns_entrytype entry,
                             uint16_t type, uint16_t rclass, uint32_t ttl, const uint8_t* data, size_t size,
                             size_t offset, size_t length);
+    static int onMdnsRecordView(MdnsRecordBatch &batch, const struct sockaddr* from, mdns_string_t &question,
+                                mdns_entrytype entry, uint16_t type, uint16_t rclass, uint32_t ttl,
+                                const uint8_t* data, size_t size, size_t offset, size_t length);
+    struct Subscription {
+        uint64_t id;
+        std::string key;       // MdnsCache::key() form, empty for any
+        mdns_recordtype type;  // IGNORE for any
+        MdnsSubscriber cb;
+    };
+    using Subscriptions = std::vector<Subscription>;
+
+    bool runReceiver(const std::atomic<bool> &stop, int msec);
+    void dispatch(const MdnsRecordView &rv);
+    bool sendQuery(const struct mdns_query_t *questions, size_t count);
+    bool sendTx();
+    void knownAnswers(const struct mdns_query_t *questions, size_t count);
+    void questionsSent(const struct mdns_query_t *questions, size_t count, uint64_t sent);
+    void answerArrived(uint16_t type, const mdns_string_t &name, uint64_t arrival);
+    void closeQuestions(uint64_t now);
+    void expireQuestions();
+    int collectRecord(MdnsRecordBatch &batch, const struct sockaddr* from, mdns_string_t &question,
+                      mdns_entrytype entry, uint16_t type, uint16_t rclass, uint32_t ttl,
+                      const uint8_t* data, size_t size, size_t offset, size_t length);
+    void cacheRecord(const MdnsRecordView &rv, uint16_t rclass, uint32_t ttl,
+                     const uint8_t* data, size_t size, size_t offset, size_t length);
 
 protected:
-    int m_4sock;
-    int m_6sock;
-    uint16_t m_tid;
+    std::vector<MdnsInterface> m_ifs;
+    std::atomic<uint16_t> m_tid;  // bumped by query() while a receive thread parses
+    struct mdns_rxring_t *m_rxring;
+    // transmit side, all under m_txMutex: packets are built once into m_txring and sent
+    // to every socket, and the scratch vectors keep their capacity between queries
+    std::mutex m_txMutex;
+    struct mdns_txring_t *m_txring;
+    struct sockaddr_in6 m_group4;  // 224.0.0.251:5353
+    struct sockaddr_in6 m_group6;  // [ff02::fb]:5353
+    socklen_t m_group4len;
+    socklen_t m_group6len;
+    std::vector<struct mdns_query_t> m_txQueries;
+    std::vector<struct mdns_record_t> m_txKnown;
+    std::vector<size_t> m_txOffsets;
+    std::string m_txRdata;
+    MdnsRxStats m_rxStats;
+    MdnsMetrics m_metrics;
+    unsigned m_rxIfindex;   // of the packet being parsed
+    uint64_t m_rxStamp;
+    // questions sent within kAnswerWindowMs, by type and MdnsCache::key(), timing their answers
+    struct Pending {
+        uint64_t sent;
+        uint64_t last;   // latest answer's arrival, 0 for none yet
+    };
+    std::mutex m_pendMutex;
+    std::map<std::string, Pending, std::less<>> m_pending;  // under m_pendMutex
+    std::atomic<size_t> m_npending;  // its size, checked without the lock
+    std::unique_ptr<MdnsCache> m_cache;
+    std::unique_ptr<MdnsScheduler> m_scheduler;
+    MdnsLoop *m_loop;
+    std::unique_ptr<MdnsLoop> m_ownLoop;
+    mdns_record_callback_fn m_rxCallback;   // set while in waitForReplies
+    MdnsRecordBatch *m_rxBatch;  // set while in responses()
+    MdnsRecordBatch m_idle;      // records only cached
+    MdnsRecordQueue *m_rxQueue;  // set while in receive()
+    MdnsRecordBatch *m_rxSlot;   // being filled by onReadable()
+    std::thread m_rxThread;      // see start()
+    std::atomic<bool> m_rxStop;
+    std::mutex m_subMutex;
+    std::shared_ptr<const Subscriptions> m_subs;    // replaced, never modified, under m_subMutex
+    std::shared_ptr<const Subscriptions> m_subsNow; // snapshot for the packet being parsed
+    uint64_t m_nextSub;
 };
 
 /*
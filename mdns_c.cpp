@@ -15,12 +15,14 @@
 #include <stddef.h>  // for size_t
 #include <stdint.h>  // for uint16_t, uint8_t, uint32_t
 #include <string.h>  // for memchr
+#include <ctype.h>   // for tolower
 
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <stdlib.h>  // for malloc, free
 
 #include "mdns.h"    // for mdns_recordtype, mdns_entrytype
 #include "mdns_c.h"
@@ -35,12 +37,51 @@ namespace mdns_class {
   };
 }
 
+static int mdns_socket_setup_ipv4_port(int sock, unsigned ifindex, uint16_t port);
+static int mdns_socket_setup_ipv6_port(int sock, unsigned ifindex, uint16_t port);
+
+// kernel drop counter with each datagram, see mdns_rxring_t::drops
+static void
+mdns_socket_drops_enable(int sock) {
+#ifdef SO_RXQ_OVFL
+	int on = 1;
+	setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, (const char*)&on, sizeof(on));
+#else
+	(void)sock;
+#endif
+}
+
+// kernel arrival time with each datagram, see mdns_rxring_t::stamps
+static void
+mdns_socket_timestamps_enable(int sock) {
+#ifdef SO_TIMESTAMPNS
+	int on = 1;
+	setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, (const char*)&on, sizeof(on));
+#else
+	(void)sock;
+#endif
+}
+
+static void
+mdns_socket_reuse(int sock) {
+	int on = 1;
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char*)&on, sizeof(on));
+#ifdef SO_REUSEPORT
+	setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (const char*)&on, sizeof(on));
+#endif
+}
+
 int
 mdns_socket_open_ipv4(void) {
+	return mdns_socket_open_ipv4_if(0);
+}
+
+int
+mdns_socket_open_ipv4_if(unsigned ifindex) {
 	int sock = (int)socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
 	if (sock < 0)
 		return -1;
-	if (mdns_socket_setup_ipv4(sock)) {
+	if (mdns_socket_setup_ipv4_if(sock, ifindex)) {
 		mdns_socket_close(sock);
 		return -1;
 	}
@@ -49,14 +90,46 @@ mdns_socket_open_ipv4(void) {
 
 int
 mdns_socket_setup_ipv4(int sock) {
+	return mdns_socket_setup_ipv4_if(sock, 0);
+}
+
+int
+mdns_socket_setup_ipv4_if(int sock, unsigned ifindex) {
+	return mdns_socket_setup_ipv4_port(sock, ifindex, 0);
+}
+
+int
+mdns_socket_open_ipv4_service(unsigned ifindex) {
+	int sock = (int)socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (sock < 0)
+		return -1;
+	if (mdns_socket_setup_ipv4_port(sock, ifindex, 5353)) {
+		mdns_socket_close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+static int
+mdns_socket_setup_ipv4_port(int sock, unsigned ifindex, uint16_t port) {
 	struct sockaddr_in saddr;
 	memset(&saddr, 0, sizeof(saddr));
 	saddr.sin_family = AF_INET;
 	saddr.sin_addr.s_addr = INADDR_ANY;
+	saddr.sin_port = htons(port);
 #ifdef __APPLE__
 	saddr.sin_len = sizeof(saddr);
 #endif
 
+	if (port) {
+		// shared with any other responder on the host; only our joined groups please
+		mdns_socket_reuse(sock);
+#ifdef IP_MULTICAST_ALL
+		int off = 0;
+		setsockopt(sock, IPPROTO_IP, IP_MULTICAST_ALL, (const char*)&off, sizeof(off));
+#endif
+	}
+
 	if (bind(sock, (struct sockaddr*)&saddr, sizeof(saddr)))
 		return -1;
 
@@ -75,21 +148,50 @@ mdns_socket_setup_ipv4(int sock) {
 	setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, (const char*)&ttl, sizeof(ttl));
 	setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, (const char*)&loopback, sizeof(loopback));
 
-	memset(&req, 0, sizeof(req));
-	req.imr_multiaddr.s_addr = htonl((((uint32_t)224U) << 24U) | ((uint32_t)251U));
-	req.imr_interface.s_addr = INADDR_ANY;
-	if (setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char*)&req, sizeof(req)))
-		return -1;
+#ifdef __linux__
+	if (ifindex) {
+		struct ip_mreqn reqn;
+		memset(&reqn, 0, sizeof(reqn));
+		reqn.imr_multiaddr.s_addr = htonl((((uint32_t)224U) << 24U) | ((uint32_t)251U));
+		reqn.imr_ifindex = (int)ifindex;
+		if (setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char*)&reqn, sizeof(reqn)))
+			return -1;
+		reqn.imr_multiaddr.s_addr = INADDR_ANY;
+		if (setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF, (char*)&reqn, sizeof(reqn)))
+			return -1;
+	}
+	else
+#endif
+	{
+		memset(&req, 0, sizeof(req));
+		req.imr_multiaddr.s_addr = htonl((((uint32_t)224U) << 24U) | ((uint32_t)251U));
+		req.imr_interface.s_addr = INADDR_ANY;
+		if (setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char*)&req, sizeof(req)))
+			return -1;
+	}
+
+#ifdef IP_PKTINFO
+	// receiving interface, see mdns_rxring_t::ifindex
+	int on = 1;
+	setsockopt(sock, IPPROTO_IP, IP_PKTINFO, (const char*)&on, sizeof(on));
+#endif
+	mdns_socket_drops_enable(sock);
+	mdns_socket_timestamps_enable(sock);
 
 	return 0;
 }
 
 int
 mdns_socket_open_ipv6(void) {
+	return mdns_socket_open_ipv6_if(0);
+}
+
+int
+mdns_socket_open_ipv6_if(unsigned ifindex) {
 	int sock = (int)socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
 	if (sock < 0)
 		return -1;
-	if (mdns_socket_setup_ipv6(sock)) {
+	if (mdns_socket_setup_ipv6_if(sock, ifindex)) {
 		mdns_socket_close(sock);
 		return -1;
 	}
@@ -98,14 +200,47 @@ mdns_socket_open_ipv6(void) {
 
 int
 mdns_socket_setup_ipv6(int sock) {
+	return mdns_socket_setup_ipv6_if(sock, 0);
+}
+
+int
+mdns_socket_setup_ipv6_if(int sock, unsigned ifindex) {
+	return mdns_socket_setup_ipv6_port(sock, ifindex, 0);
+}
+
+int
+mdns_socket_open_ipv6_service(unsigned ifindex) {
+	int sock = (int)socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+	if (sock < 0)
+		return -1;
+	if (mdns_socket_setup_ipv6_port(sock, ifindex, 5353)) {
+		mdns_socket_close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+static int
+mdns_socket_setup_ipv6_port(int sock, unsigned ifindex, uint16_t port) {
 	struct sockaddr_in6 saddr;
 	memset(&saddr, 0, sizeof(saddr));
 	saddr.sin6_family = AF_INET6;
 	saddr.sin6_addr = in6addr_any;
+	saddr.sin6_port = htons(port);
 #ifdef __APPLE__
 	saddr.sin6_len = sizeof(saddr);
 #endif
 
+	if (port) {
+		int on = 1;
+		setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, (const char*)&on, sizeof(on));
+		mdns_socket_reuse(sock);
+#ifdef IPV6_MULTICAST_ALL
+		int off = 0;
+		setsockopt(sock, IPPROTO_IPV6, IPV6_MULTICAST_ALL, (const char*)&off, sizeof(off));
+#endif
+	}
+
 	if (bind(sock, (struct sockaddr*)&saddr, sizeof(saddr)))
 		return -1;
 
@@ -128,12 +263,62 @@ mdns_socket_setup_ipv6(int sock) {
 	req.ipv6mr_multiaddr.s6_addr[0] = 0xFF;
 	req.ipv6mr_multiaddr.s6_addr[1] = 0x02;
 	req.ipv6mr_multiaddr.s6_addr[15] = 0xFB;
+	req.ipv6mr_interface = ifindex;
 	if (setsockopt(sock, IPPROTO_IPV6, IPV6_JOIN_GROUP, (char*)&req, sizeof(req)))
 		return -1;
+	if (ifindex &&
+	    setsockopt(sock, IPPROTO_IPV6, IPV6_MULTICAST_IF, (const char*)&ifindex, sizeof(ifindex)))
+		return -1;
+
+#ifdef IPV6_RECVPKTINFO
+	int on = 1;
+	setsockopt(sock, IPPROTO_IPV6, IPV6_RECVPKTINFO, (const char*)&on, sizeof(on));
+#endif
+	mdns_socket_drops_enable(sock);
+	mdns_socket_timestamps_enable(sock);
 
 	return 0;
 }
 
+int
+mdns_socket_buffers(int sock, int rcvbuf, int sndbuf) {
+	int rv = 0;
+	if ((rcvbuf > 0) && setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (const char*)&rcvbuf, sizeof(rcvbuf)))
+		rv = -1;
+	if ((sndbuf > 0) && setsockopt(sock, SOL_SOCKET, SO_SNDBUF, (const char*)&sndbuf, sizeof(sndbuf)))
+		rv = -1;
+#if defined(SO_RCVBUFFORCE) && defined(SO_SNDBUFFORCE)
+	// linux grants double the request, capped by net.core.[rw]mem_max; past the cap
+	// needs CAP_NET_ADMIN, and without it the capped size stands
+	int rcvgot = 0, sndgot = 0;
+	if (!rv && !mdns_socket_buffers_get(sock, &rcvgot, &sndgot)) {
+		if ((rcvbuf > 0) && (rcvgot / 2 < rcvbuf))
+			setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, (const char*)&rcvbuf, sizeof(rcvbuf));
+		if ((sndbuf > 0) && (sndgot / 2 < sndbuf))
+			setsockopt(sock, SOL_SOCKET, SO_SNDBUFFORCE, (const char*)&sndbuf, sizeof(sndbuf));
+	}
+#endif
+	return rv;
+}
+
+int
+mdns_socket_buffers_get(int sock, int* rcvbuf, int* sndbuf) {
+	socklen_t len = sizeof(int);
+	if (rcvbuf && getsockopt(sock, SOL_SOCKET, SO_RCVBUF, (char*)rcvbuf, &len))
+		return -1;
+	len = sizeof(int);
+	if (sndbuf && getsockopt(sock, SOL_SOCKET, SO_SNDBUF, (char*)sndbuf, &len))
+		return -1;
+	return 0;
+}
+
+uint64_t
+mdns_time_ns(void) {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
 void
 mdns_socket_close(int sock) {
 #ifdef _WIN32
@@ -152,20 +337,27 @@ mdns_string_pair_t
 mdns_get_next_substring(const uint8_t* rawdata, size_t size, size_t offset) {
 	const uint8_t* buffer = rawdata;
 	mdns_string_pair_t pair = {MDNS_INVALID_POS, 0, 0};
+	if (offset >= size)
+		return pair;
 	if (!buffer[offset]) {
 		pair.offset = offset;
 		return pair;
 	}
-	if (mdns_is_string_ref(buffer[offset])) {
+	// Follow pointers, which must point strictly backwards so a chain always ends
+	while (mdns_is_string_ref(buffer[offset])) {
 		if (size < offset + 2)
 			return pair;
 
-		offset = (((size_t)(0x3f & buffer[offset]) << 8) | (size_t)buffer[offset + 1]);
-		if (offset >= size)
+		size_t target = (((size_t)(0x3f & buffer[offset]) << 8) | (size_t)buffer[offset + 1]);
+		if (target >= offset)
 			return pair;
-
+		offset = target;
 		pair.ref = 1;
 	}
+	if (!buffer[offset]) {
+		pair.offset = offset;
+		return pair;
+	}
 
 	size_t length = (size_t)buffer[offset++];
 	if (size < offset + length)
@@ -181,8 +373,11 @@ mdns_get_next_substring(const uint8_t* rawdata, size_t size, size_t offset) {
 int 
 mdns_string_skip(const uint8_t* buffer, size_t size, size_t* offset) {
 	size_t cur = *offset;
+	size_t labels = 0;
 	mdns_string_pair_t substr;
 	do {
+		if (++labels > MDNS_MAX_LABELS)
+			return 0;
 		substr = mdns_get_next_substring(buffer, size, cur);
         //        printf("%s: +%d [%.*s]\n", __func__, substr.offset, MDNS_STRING_PAIR_FORMAT(substr, buffer));
 		if (substr.offset == MDNS_INVALID_POS)
@@ -208,7 +403,10 @@ mdns_string_equal(const uint8_t* buffer_lhs, size_t size_lhs, size_t* ofs_lhs,
 	size_t rhs_end = MDNS_INVALID_POS;
 	mdns_string_pair_t lhs_substr;
 	mdns_string_pair_t rhs_substr;
+	size_t labels = 0;
 	do {
+		if (++labels > MDNS_MAX_LABELS)
+			return 0;
 		lhs_substr = mdns_get_next_substring(buffer_lhs, size_lhs, lhs_cur);
 		rhs_substr = mdns_get_next_substring(buffer_rhs, size_rhs, rhs_cur);
 		if ((lhs_substr.offset == MDNS_INVALID_POS) || (rhs_substr.offset == MDNS_INVALID_POS))
@@ -247,7 +445,10 @@ mdns_string_extract(const uint8_t* buffer, size_t size, size_t* offset,
 	mdns_string_t result = {str, 0};
 	char* dst = str;
 	size_t remain = capacity;
+	size_t labels = 0;
 	do {
+		if (++labels > MDNS_MAX_LABELS)
+			return result;
 		substr = mdns_get_next_substring(buffer, size, cur);
 		if (substr.offset == MDNS_INVALID_POS)
 			return result;
@@ -286,6 +487,18 @@ mdns_string_find(const char* str, size_t length, char c, size_t offset) {
 	return MDNS_INVALID_POS;
 }
 
+mdns_string_t
+mdns_string_key(const char* name, size_t length, char* str, size_t capacity) {
+	if ((length > 0) && (name[length - 1] == '.'))
+		--length;
+	if (length > capacity)
+		length = capacity;
+	for (size_t i = 0; i < length; ++i)
+		str[i] = (char)tolower((unsigned char)name[i]);
+	mdns_string_t result = {str, length};
+	return result;
+}
+
 uint8_t*
 mdns_string_make(uint8_t* data, size_t capacity, const char* name, size_t length) {
 	size_t pos = 0;
@@ -323,31 +536,67 @@ mdns_string_make(uint8_t* data, size_t capacity, const char* name, size_t length
 	return dest;
 }
 
-size_t
-mdns_records_parse(const struct sockaddr* from, mdns_string_t &question, const uint8_t* buffer, size_t size, size_t* offset,
-                   mdns_entrytype type, size_t records, mdns_record_callback_fn callback) {
-	size_t parsed = 0;
-	int do_callback = 1;
-	for (size_t i = 0; i < records; ++i) {
-		mdns_string_skip(buffer, size, offset);
-		const uint16_t* data = (const uint16_t*)((const char*)buffer + (*offset));
-
-		uint16_t rtype = ntohs(*data++);
-		uint16_t rclass = ntohs(*data++);
-		uint32_t ttl = ntohs(*(const uint32_t*)(const uint8_t*)data); data += 2;
-		uint16_t length = ntohs(*data++);
-
-		*offset += 10;
-
-		if (do_callback) {
-			++parsed;
-			if (callback(from, question, type, rtype, rclass, ttl, buffer, size, (*offset), length))
-				do_callback = 0;
+// Compare the dotted name[0..length) with the (possibly compressed) encoded name at ofs in packet
+static int
+mdns_string_equal_text(const uint8_t* packet, size_t size, size_t ofs, const char* name, size_t length) {
+	size_t pos = 0;
+	mdns_string_pair_t substr;
+	do {
+		substr = mdns_get_next_substring(packet, size, ofs);
+		if (substr.offset == MDNS_INVALID_POS)
+			return 0;
+		if (substr.length) {
+			if ((pos + substr.length > length) ||
+			    strncasecmp((const char*)packet + substr.offset, name + pos, substr.length))
+				return 0;
+			pos += substr.length;
+			if ((pos < length) && (name[pos] == '.'))
+				++pos;
+			else if (pos < length)
+				return 0;
 		}
+		ofs = substr.offset + substr.length;
+	}
+	while (substr.length);
+	return pos == length;
+}
 
-		*offset += length;
+uint8_t*
+mdns_string_make_compressed(uint8_t* packet, size_t capacity, uint8_t* dest, const char* name, size_t length,
+                            mdns_name_table_t* table) {
+	if ((length > 0) && (name[length - 1] == '.'))
+		--length;
+	size_t last_pos = 0;
+	while (last_pos < length) {
+		// Longest previously written suffix wins, i.e. the first one found walking left to right
+		for (size_t i = 0; i < table->count; ++i) {
+			if (mdns_string_equal_text(packet, (size_t)(dest - packet), table->offsets[i],
+			                           name + last_pos, length - last_pos)) {
+				if ((size_t)(dest - packet) + 2 > capacity)
+					return 0;
+				*dest++ = (uint8_t)(0xC0 | (table->offsets[i] >> 8));
+				*dest++ = (uint8_t)(table->offsets[i] & 0xFF);
+				return dest;
+			}
+		}
+		size_t pos = mdns_string_find(name, length, '.', last_pos);
+		if (pos == MDNS_INVALID_POS)
+			pos = length;
+		size_t sublength = pos - last_pos;
+		if ((sublength > 63) || ((size_t)(dest - packet) + sublength + 1 >= capacity))
+			return 0;
+		size_t label_ofs = (size_t)(dest - packet);
+		if ((table->count < MDNS_NAME_TABLE_SIZE) && (label_ofs < 0x3FFF))
+			table->offsets[table->count++] = (uint16_t)label_ofs;
+		*dest = (unsigned char)sublength;
+		memcpy(dest + 1, name + last_pos, sublength);
+		dest += sublength + 1;
+		last_pos = pos + 1;
 	}
-	return parsed;
+	if ((size_t)(dest - packet) >= capacity)
+		return 0;
+	*dest++ = 0;
+	return dest;
 }
 
 static const uint8_t mdns_services_query[] = {
@@ -373,38 +622,50 @@ static const uint8_t mdns_services_query[] = {
 	0x80, mdns_class::IN
 };
 
-int
-mdns_discovery_send(int sock) {
-	struct sockaddr_in addr;
-	struct sockaddr_in6 addr6;
-	struct sockaddr* saddr = (struct sockaddr*)&addr;
-	socklen_t saddrlen = sizeof(struct sockaddr);
-	if (getsockname(sock, saddr, &saddrlen))
-		return -1;
-	if (saddr->sa_family == AF_INET6) {
-		memset(&addr6, 0, sizeof(struct sockaddr_in6));
-		addr6.sin6_family = AF_INET6;
+socklen_t
+mdns_multicast_group(int family, struct sockaddr_in6* storage) {
+	if (family == AF_INET6) {
+		struct sockaddr_in6* addr6 = storage;
+		memset(addr6, 0, sizeof(struct sockaddr_in6));
+		addr6->sin6_family = AF_INET6;
 #ifdef __APPLE__
-		addr6.sin6_len = sizeof(struct sockaddr_in6);
+		addr6->sin6_len = sizeof(struct sockaddr_in6);
 #endif
-		addr6.sin6_addr.s6_addr[0] = 0xFF;
-		addr6.sin6_addr.s6_addr[1] = 0x02;
-		addr6.sin6_addr.s6_addr[15] = 0xFB;
-		addr6.sin6_port = htons((unsigned short)5353);
-		saddr = (struct sockaddr*)&addr6;
-		saddrlen = sizeof(struct sockaddr_in6);
-	}
-	else {
-		memset(&addr, 0, sizeof(struct sockaddr_in));
-		addr.sin_family = AF_INET;
+		addr6->sin6_addr.s6_addr[0] = 0xFF;
+		addr6->sin6_addr.s6_addr[1] = 0x02;
+		addr6->sin6_addr.s6_addr[15] = 0xFB;
+		addr6->sin6_port = htons((unsigned short)5353);
+		return sizeof(struct sockaddr_in6);
+	}
+	struct sockaddr_in* addr = (struct sockaddr_in*)storage;
+	memset(addr, 0, sizeof(struct sockaddr_in));
+	addr->sin_family = AF_INET;
 #ifdef __APPLE__
-		addr.sin_len = sizeof(struct sockaddr_in);
+	addr->sin_len = sizeof(struct sockaddr_in);
 #endif
-		addr.sin_addr.s_addr = htonl((((uint32_t)224U) << 24U) | ((uint32_t)251U));
-		addr.sin_port = htons((unsigned short)5353);
-		saddr = (struct sockaddr*)&addr;
-		saddrlen = sizeof(struct sockaddr_in);
-	}
+	addr->sin_addr.s_addr = htonl((((uint32_t)224U) << 24U) | ((uint32_t)251U));
+	addr->sin_port = htons((unsigned short)5353);
+	return sizeof(struct sockaddr_in);
+}
+
+// Fill saddr with the mDNS multicast group matching the address family of sock
+static int
+mdns_multicast_addr(int sock, struct sockaddr_in6* storage, struct sockaddr** saddr, socklen_t* saddrlen) {
+	*saddr = (struct sockaddr*)storage;
+	*saddrlen = sizeof(struct sockaddr_in6);
+	if (getsockname(sock, *saddr, saddrlen))
+		return -1;
+	*saddrlen = mdns_multicast_group((*saddr)->sa_family, storage);
+	return 0;
+}
+
+int
+mdns_discovery_send(int sock) {
+	struct sockaddr_in6 storage;
+	struct sockaddr* saddr;
+	socklen_t saddrlen;
+	if (mdns_multicast_addr(sock, &storage, &saddr, &saddrlen))
+		return -1;
 
 	if (sendto(sock, mdns_services_query, sizeof(mdns_services_query), 0,
 	           saddr, saddrlen) < 0)
@@ -414,163 +675,550 @@ mdns_discovery_send(int sock) {
 
 int
 mdns_query_send(int sock, uint16_t tid, mdns_recordtype type, const char* name, size_t length) {
-    size_t capacity=2048; // 17 + length
-    uint8_t* buffer=(uint8_t*)malloc(capacity);
-
-	uint16_t* data = (uint16_t*)buffer;
-	//Transaction ID
-	*data++ = htons(tid);
-	//Flags
-	*data++ = 0;
-	//Questions
-	*data++ = htons(1);
-	//No answer, authority or additional RRs
-	*data++ = 0;
-	*data++ = 0;
-	*data++ = 0;
-	//Name string
-	data = (uint16_t*)mdns_string_make((uint8_t*)data, capacity - 17, name, length);
-	if (!data) {
-        free(buffer);
+	mdns_query_t query = {type, name, length};
+	return (mdns_multiquery_send(sock, tid, &query, 1) == 1) ? 0 : -1;
+}
+
+// Owner name, type, class, ttl and a zero rdlength; returns where the rdata goes
+static uint8_t*
+mdns_record_header_make(uint8_t* packet, size_t capacity, uint8_t* dest, const char* name, size_t length,
+                        uint16_t type, uint16_t rclass, uint32_t ttl, mdns_name_table_t* table) {
+	dest = mdns_string_make_compressed(packet, capacity, dest, name, length, table);
+	if (!dest || ((size_t)(dest - packet) + 10 > capacity))
+		return 0;
+	*dest++ = (uint8_t)(type >> 8);
+	*dest++ = (uint8_t)(type);
+	*dest++ = (uint8_t)(rclass >> 8);
+	*dest++ = (uint8_t)(rclass);
+	*dest++ = (uint8_t)(ttl >> 24);
+	*dest++ = (uint8_t)(ttl >> 16);
+	*dest++ = (uint8_t)(ttl >> 8);
+	*dest++ = (uint8_t)(ttl);
+	*dest++ = 0;
+	*dest++ = 0;
+	return dest;
+}
+
+static uint8_t*
+mdns_record_length_set(uint8_t* rdata, uint8_t* end) {
+	size_t length = (size_t)(end - rdata);
+	rdata[-2] = (uint8_t)(length >> 8);
+	rdata[-1] = (uint8_t)(length);
+	return end;
+}
+
+uint8_t*
+mdns_record_make(uint8_t* packet, size_t capacity, uint8_t* dest, const mdns_record_t* record,
+                 mdns_name_table_t* table) {
+	uint8_t* rdata = mdns_record_header_make(packet, capacity, dest, record->name, record->length,
+	                                         record->type, record->rclass, record->ttl, table);
+	if (!rdata)
+		return 0;
+	// Names inside PTR and SRV rdata are compressed too (RFC 6762 section 18.14)
+	char namebuffer[256];
+	size_t offset = 0;
+	uint8_t* end;
+	switch (record->type) {
+	case mdns_recordtype::PTR: {
+		mdns_string_t target = mdns_string_extract(record->rdata, record->rdata_length, &offset,
+		                                           namebuffer, sizeof(namebuffer));
+		end = mdns_string_make_compressed(packet, capacity, rdata, target.str, target.length, table);
+		break;
+	}
+	case mdns_recordtype::SRV: {
+		if ((record->rdata_length < 7) || ((size_t)(rdata - packet) + 6 > capacity))
+			return 0;
+		memcpy(rdata, record->rdata, 6);
+		offset = 6;
+		mdns_string_t target = mdns_string_extract(record->rdata, record->rdata_length, &offset,
+		                                           namebuffer, sizeof(namebuffer));
+		end = mdns_string_make_compressed(packet, capacity, rdata + 6, target.str, target.length, table);
+		break;
+	}
+	default:
+		if ((size_t)(rdata - packet) + record->rdata_length > capacity)
+			return 0;
+		memcpy(rdata, record->rdata, record->rdata_length);
+		end = rdata + record->rdata_length;
+		break;
+	}
+	return end ? mdns_record_length_set(rdata, end) : 0;
+}
+
+void
+mdns_writer_init(mdns_writer_t* writer, uint8_t* buffer, size_t capacity, uint16_t tid, uint16_t flags) {
+	writer->buffer = buffer;
+	writer->capacity = capacity;
+	writer->dest = buffer + 12;
+	writer->table.count = 0;
+	writer->section = 0;
+	memset(writer->counts, 0, sizeof(writer->counts));
+	memset(buffer, 0, 12);
+	buffer[0] = (uint8_t)(tid >> 8);
+	buffer[1] = (uint8_t)(tid);
+	buffer[2] = (uint8_t)(flags >> 8);
+	buffer[3] = (uint8_t)(flags);
+}
+
+int
+mdns_writer_question(mdns_writer_t* writer, const char* name, size_t length, uint16_t type, uint16_t qclass) {
+	if (writer->section > 0)
 		return -1;
-    }
-	//Record type
-	*data++ = htons(type);
-	//! Unicast response, class IN
-	*data++ = htons(0x8000U | mdns_class::IN);
-
-	struct sockaddr_in addr;
-	struct sockaddr_in6 addr6;
-	struct sockaddr* saddr = (struct sockaddr*)&addr;
-	socklen_t saddrlen = sizeof(struct sockaddr);
-	if (getsockname(sock, saddr, &saddrlen)) {
-        free(buffer);
+	size_t mark = writer->table.count;
+	uint8_t* end = mdns_string_make_compressed(writer->buffer, writer->capacity - 4, writer->dest,
+	                                           name, length, &writer->table);
+	if (!end) {
+		writer->table.count = mark;
 		return -1;
-    }
-	if (saddr->sa_family == AF_INET6) {
-		memset(&addr6, 0, sizeof(struct sockaddr_in6));
-		addr6.sin6_family = AF_INET6;
-#ifdef __APPLE__
-		addr6.sin6_len = sizeof(struct sockaddr_in6);
-#endif
-		addr6.sin6_addr.s6_addr[0] = 0xFF;
-		addr6.sin6_addr.s6_addr[1] = 0x02;
-		addr6.sin6_addr.s6_addr[15] = 0xFB;
-		addr6.sin6_port = htons((unsigned short)5353);
-		saddr = (struct sockaddr*)&addr6;
-		saddrlen = sizeof(struct sockaddr_in6);
-	}
-	else {
-		memset(&addr, 0, sizeof(struct sockaddr_in));
-		addr.sin_family = AF_INET;
-#ifdef __APPLE__
-		addr.sin_len = sizeof(struct sockaddr_in);
-#endif
-		addr.sin_addr.s_addr = htonl((((uint32_t)224U) << 24U) | ((uint32_t)251U));
-		addr.sin_port = htons((unsigned short)5353);
-		saddr = (struct sockaddr*)&addr;
-		saddrlen = sizeof(struct sockaddr_in);
 	}
+	*end++ = (uint8_t)(type >> 8);
+	*end++ = (uint8_t)(type);
+	*end++ = (uint8_t)(qclass >> 8);
+	*end++ = (uint8_t)(qclass);
+	writer->dest = end;
+	++writer->counts[0];
+	return 0;
+}
+
+// Commit a record written by one of the mdns_writer_* calls, or roll the table back
+static int
+mdns_writer_commit(mdns_writer_t* writer, mdns_entrytype section, uint8_t* end, size_t mark) {
+	if (!end) {
+		writer->table.count = mark;
+		return -1;
+	}
+	writer->dest = end;
+	writer->section = section;
+	++writer->counts[section];
+	return 0;
+}
+
+int
+mdns_writer_record(mdns_writer_t* writer, mdns_entrytype section, const mdns_record_t* record) {
+	if ((section < writer->section) || (section > mdns_entrytype::ADDITIONAL))
+		return -1;
+	size_t mark = writer->table.count;
+	return mdns_writer_commit(writer, section,
+	                          mdns_record_make(writer->buffer, writer->capacity, writer->dest, record,
+	                                           &writer->table), mark);
+}
+
+// Raw rdata behind a freshly written record header
+static int
+mdns_writer_rdata(mdns_writer_t* writer, mdns_entrytype section, const char* name, size_t length,
+                  uint16_t type, uint16_t rclass, uint32_t ttl, const void* data, size_t size) {
+	if ((section < writer->section) || (section > mdns_entrytype::ADDITIONAL))
+		return -1;
+	size_t mark = writer->table.count;
+	uint8_t* rdata = mdns_record_header_make(writer->buffer, writer->capacity, writer->dest, name, length,
+	                                         type, rclass, ttl, &writer->table);
+	uint8_t* end = 0;
+	if (rdata && ((size_t)(rdata - writer->buffer) + size <= writer->capacity)) {
+		memcpy(rdata, data, size);
+		end = mdns_record_length_set(rdata, rdata + size);
+	}
+	return mdns_writer_commit(writer, section, end, mark);
+}
+
+int
+mdns_writer_a(mdns_writer_t* writer, mdns_entrytype section, const char* name, size_t length,
+              uint16_t rclass, uint32_t ttl, const struct in_addr* addr) {
+	return mdns_writer_rdata(writer, section, name, length, mdns_recordtype::A, rclass, ttl, addr, 4);
+}
+
+int
+mdns_writer_aaaa(mdns_writer_t* writer, mdns_entrytype section, const char* name, size_t length,
+                 uint16_t rclass, uint32_t ttl, const struct in6_addr* addr) {
+	return mdns_writer_rdata(writer, section, name, length, mdns_recordtype::AAAA, rclass, ttl, addr, 16);
+}
+
+int
+mdns_writer_ptr(mdns_writer_t* writer, mdns_entrytype section, const char* name, size_t length,
+                uint16_t rclass, uint32_t ttl, const char* target, size_t target_length) {
+	if ((section < writer->section) || (section > mdns_entrytype::ADDITIONAL))
+		return -1;
+	size_t mark = writer->table.count;
+	uint8_t* rdata = mdns_record_header_make(writer->buffer, writer->capacity, writer->dest, name, length,
+	                                         mdns_recordtype::PTR, rclass, ttl, &writer->table);
+	uint8_t* end = 0;
+	if (rdata) {
+		end = mdns_string_make_compressed(writer->buffer, writer->capacity, rdata, target, target_length,
+		                                  &writer->table);
+		if (end)
+			mdns_record_length_set(rdata, end);
+	}
+	return mdns_writer_commit(writer, section, end, mark);
+}
+
+int
+mdns_writer_srv(mdns_writer_t* writer, mdns_entrytype section, const char* name, size_t length,
+                uint16_t rclass, uint32_t ttl, uint16_t priority, uint16_t weight, uint16_t port,
+                const char* target, size_t target_length) {
+	if ((section < writer->section) || (section > mdns_entrytype::ADDITIONAL))
+		return -1;
+	size_t mark = writer->table.count;
+	uint8_t* rdata = mdns_record_header_make(writer->buffer, writer->capacity, writer->dest, name, length,
+	                                         mdns_recordtype::SRV, rclass, ttl, &writer->table);
+	uint8_t* end = 0;
+	if (rdata && ((size_t)(rdata - writer->buffer) + 6 <= writer->capacity)) {
+		rdata[0] = (uint8_t)(priority >> 8);
+		rdata[1] = (uint8_t)(priority);
+		rdata[2] = (uint8_t)(weight >> 8);
+		rdata[3] = (uint8_t)(weight);
+		rdata[4] = (uint8_t)(port >> 8);
+		rdata[5] = (uint8_t)(port);
+		end = mdns_string_make_compressed(writer->buffer, writer->capacity, rdata + 6, target, target_length,
+		                                  &writer->table);
+		if (end)
+			mdns_record_length_set(rdata, end);
+	}
+	return mdns_writer_commit(writer, section, end, mark);
+}
+
+int
+mdns_writer_txt(mdns_writer_t* writer, mdns_entrytype section, const char* name, size_t length,
+                uint16_t rclass, uint32_t ttl, const mdns_record_txt_t* txt, size_t count) {
+	if ((section < writer->section) || (section > mdns_entrytype::ADDITIONAL))
+		return -1;
+	size_t mark = writer->table.count;
+	uint8_t* rdata = mdns_record_header_make(writer->buffer, writer->capacity, writer->dest, name, length,
+	                                         mdns_recordtype::TXT, rclass, ttl, &writer->table);
+	uint8_t* end = rdata;
+	for (size_t i = 0; end && (i < count); ++i) {
+		// RFC 6763 section 6.1: "key=value", or a bare "key" for a boolean attribute
+		size_t sublength = txt[i].key.length + (txt[i].value.length ? 1 + txt[i].value.length : 0);
+		if ((sublength > 255) || ((size_t)(end - writer->buffer) + 1 + sublength > writer->capacity)) {
+			end = 0;
+			break;
+		}
+		*end++ = (uint8_t)sublength;
+		memcpy(end, txt[i].key.str, txt[i].key.length);
+		end += txt[i].key.length;
+		if (txt[i].value.length) {
+			*end++ = '=';
+			memcpy(end, txt[i].value.str, txt[i].value.length);
+			end += txt[i].value.length;
+		}
+	}
+	if (end && (end == rdata)) {
+		// an empty TXT record is a single empty string
+		if ((size_t)(end - writer->buffer) + 1 > writer->capacity)
+			end = 0;
+		else
+			*end++ = 0;
+	}
+	if (end)
+		mdns_record_length_set(rdata, end);
+	return mdns_writer_commit(writer, section, end, mark);
+}
+
+size_t
+mdns_writer_finish(mdns_writer_t* writer) {
+	for (int i = 0; i < 4; ++i) {
+		writer->buffer[4 + 2 * i] = (uint8_t)(writer->counts[i] >> 8);
+		writer->buffer[5 + 2 * i] = (uint8_t)(writer->counts[i]);
+	}
+	return (size_t)(writer->dest - writer->buffer);
+}
+
+int
+mdns_multiquery_send(int sock, uint16_t tid, const mdns_query_t* queries, size_t count) {
+	return mdns_multiquery_send_known(sock, tid, queries, count, 0, 0);
+}
+
+// Whether record fits an otherwise empty packet
+static int
+mdns_record_fits_alone(const mdns_record_t* record) {
+	uint8_t buffer[MDNS_PACKET_MTU];
+	mdns_writer_t writer;
+	mdns_writer_init(&writer, buffer, sizeof(buffer), 0, 0);
+	return !mdns_writer_record(&writer, mdns_entrytype::ANSWER, record);
+}
+
+// Build the packets for queries and answers into the free slots of ring, resuming from
+// question *qi and answer *ai; 0 when everything is in, 1 when the ring filled up first,
+// -1 for a question too big for any packet
+static int
+mdns_txring_fill(mdns_txring_t* ring, uint16_t tid, const mdns_query_t* queries, size_t count, size_t* qi,
+                 const mdns_record_t* answers, size_t nanswers, size_t* ai) {
+	mdns_writer_t writer;
+	size_t i = *qi;
+	size_t a = *ai;
+	int rv = 0;
+	while ((i < count) || (a < nanswers)) {
+		if (ring->count == MDNS_TX_BURST) {
+			rv = 1;
+			break;
+		}
+		uint8_t* buffer = ring->buffers[ring->count];
+		mdns_writer_init(&writer, buffer, MDNS_PACKET_MTU, tid, 0);
+		for (; i < count; ++i) {
+			//! Unicast response, class IN
+			if (mdns_writer_question(&writer, queries[i].name, queries[i].length, queries[i].type,
+			                         0x8000U | mdns_class::IN)) {
+				if (!writer.counts[0])
+					return -1;  // a lone question that cannot fit is an error, not a split
+				break;
+			}
+		}
+		// Known answers follow the last question; whatever does not fit goes in
+		// follow-up packets, each but the last with TC set (RFC 6762 section 7.2)
+		if (i == count) {
+			for (; a < nanswers; ++a) {
+				if (mdns_writer_record(&writer, mdns_entrytype::ANSWER, &answers[a])) {
+					if (!mdns_record_fits_alone(&answers[a]))
+						continue;  // too big for any packet, leave it out
+					break;
+				}
+			}
+			if (a < nanswers)
+				buffer[2] |= 0x02;
+		}
+		// only oversized answers were left: nothing to send
+		if (!writer.counts[0] && !writer.counts[mdns_entrytype::ANSWER])
+			break;
+		ring->lengths[ring->count++] = mdns_writer_finish(&writer);
+	}
+	*qi = i;
+	*ai = a;
+	return rv;
+}
+
+int
+mdns_multiquery_send_known(int sock, uint16_t tid, const mdns_query_t* queries, size_t count,
+                           const mdns_record_t* answers, size_t nanswers) {
+	struct sockaddr_in6 storage;
+	struct sockaddr* saddr;
+	socklen_t saddrlen;
+	if (mdns_multicast_addr(sock, &storage, &saddr, &saddrlen))
+		return -1;
+
+	mdns_txring_t ring;
+	size_t i = 0;
+	size_t a = 0;
+	int sent = 0;
+	int more;
+	do {
+		ring.count = 0;
+		more = mdns_txring_fill(&ring, tid, queries, count, &i, answers, nanswers, &a);
+		if (more < 0)
+			return -1;
+		int ret = mdns_txring_send(sock, &ring, saddr, saddrlen);
+		if (ret < 0)
+			return -1;
+		sent += ret;
+	} while (more);
+	return sent;
+}
 
-	int rv = (sendto(sock, buffer, (char*)data - (char*)buffer, 0,
-                     saddr, saddrlen) < 0) ? -1 : 0;
-    free(buffer);
-    return rv;
+void
+mdns_txring_clear(mdns_txring_t* ring) {
+	ring->count = 0;
+}
+
+int
+mdns_txring_query(mdns_txring_t* ring, uint16_t tid, const mdns_query_t* queries, size_t count,
+                  const mdns_record_t* answers, size_t nanswers) {
+	size_t mark = ring->count;
+	size_t i = 0;
+	size_t a = 0;
+	if (mdns_txring_fill(ring, tid, queries, count, &i, answers, nanswers, &a)) {
+		ring->count = mark;
+		return -1;
+	}
+	return (int)(ring->count - mark);
+}
+
+int
+mdns_txring_discovery(mdns_txring_t* ring) {
+	if (ring->count == MDNS_TX_BURST)
+		return -1;
+	memcpy(ring->buffers[ring->count], mdns_services_query, sizeof(mdns_services_query));
+	ring->lengths[ring->count++] = sizeof(mdns_services_query);
+	return 0;
+}
+
+int
+mdns_txring_send(int sock, const mdns_txring_t* ring, const struct sockaddr* to, socklen_t tolen) {
+	if (!ring->count)
+		return 0;
+#ifdef __linux__
+	struct mmsghdr hdrs[MDNS_TX_BURST];
+	struct iovec iovs[MDNS_TX_BURST];
+	memset(hdrs, 0, sizeof(hdrs));
+	for (size_t i = 0; i < ring->count; ++i) {
+		iovs[i].iov_base = (void*)ring->buffers[i];
+		iovs[i].iov_len = ring->lengths[i];
+		hdrs[i].msg_hdr.msg_name = (void*)to;
+		hdrs[i].msg_hdr.msg_namelen = tolen;
+		hdrs[i].msg_hdr.msg_iov = &iovs[i];
+		hdrs[i].msg_hdr.msg_iovlen = 1;
+	}
+	size_t sent = 0;
+	while (sent < ring->count) {
+		int ret = sendmmsg(sock, hdrs + sent, (unsigned int)(ring->count - sent), 0);
+		if (ret <= 0)
+			return sent ? (int)sent : -1;
+		sent += (size_t)ret;
+	}
+	return (int)sent;
+#else
+	size_t sent = 0;
+	for (; sent < ring->count; ++sent) {
+		if (sendto(sock, ring->buffers[sent], ring->lengths[sent], 0, to, tolen) < 0)
+			return sent ? (int)sent : -1;
+	}
+	return (int)sent;
+#endif
 }
 
 size_t
 mdns_recv(int sock, uint16_t tid, uint8_t* buffer, size_t capacity,
           mdns_record_callback_fn callback) {
-	struct sockaddr_in6 addr;
-	struct sockaddr* saddr = (struct sockaddr*)&addr;
-	memset(&addr, 0, sizeof(addr));
-	saddr->sa_family = AF_INET;
-#ifdef __APPLE__
-	saddr->sa_len = sizeof(addr);
+	return mdns_recv<const mdns_record_callback_fn&>(sock, tid, buffer, capacity, callback);
+}
+
+int
+mdns_rxring_init(mdns_rxring_t* ring, size_t slots, size_t capacity) {
+	memset(ring, 0, sizeof(mdns_rxring_t));
+	ring->buffers = (uint8_t*)malloc(slots * capacity);
+	ring->addrs = (struct sockaddr_in6*)calloc(slots, sizeof(struct sockaddr_in6));
+	ring->lengths = (size_t*)calloc(slots, sizeof(size_t));
+	ring->ifindex = (unsigned*)calloc(slots, sizeof(unsigned));
+	ring->stamps = (uint64_t*)calloc(slots, sizeof(uint64_t));
+#ifdef __linux__
+	ring->hdrs = calloc(slots, sizeof(struct mmsghdr));
+	ring->iovs = calloc(slots, sizeof(struct iovec));
+	ring->control = (uint8_t*)calloc(slots, MDNS_RX_CONTROL);
 #endif
-	socklen_t addrlen = sizeof(addr);
-	int ret = recvfrom(sock, buffer, capacity, 0, saddr, &addrlen);
-	if (ret <= 0)
-		return 0;
+	if (!ring->buffers || !ring->addrs || !ring->lengths || !ring->ifindex || !ring->stamps
+#ifdef __linux__
+	    || !ring->hdrs || !ring->iovs || !ring->control
+#endif
+	    ) {
+		mdns_rxring_free(ring);
+		return -1;
+	}
+	ring->slots = slots;
+	ring->capacity = capacity;
+	return 0;
+}
 
-	size_t data_size = (size_t)ret;
-	uint16_t* data = (uint16_t*)buffer;
+void
+mdns_rxring_free(mdns_rxring_t* ring) {
+	free(ring->buffers);
+	free(ring->addrs);
+	free(ring->lengths);
+	free(ring->ifindex);
+	free(ring->stamps);
+	free(ring->hdrs);
+	free(ring->iovs);
+	free(ring->control);
+	memset(ring, 0, sizeof(mdns_rxring_t));
+}
 
-	uint16_t transaction_id = ntohs(*data++);
-	uint16_t flags          = ntohs(*data++);
-	uint16_t questions      = ntohs(*data++);
-	uint16_t answer_rrs     = ntohs(*data++);
-	uint16_t authority_rrs  = ntohs(*data++);
-	uint16_t additional_rrs = ntohs(*data++);
+size_t
+mdns_recv_batch(int sock, mdns_rxring_t* ring) {
+	size_t received = 0;
+#ifdef __linux__
+	struct mmsghdr* hdrs = (struct mmsghdr*)ring->hdrs;
+	struct iovec* iovs = (struct iovec*)ring->iovs;
+	for (size_t i = 0; i < ring->slots; ++i) {
+		iovs[i].iov_base = ring->buffers + (i * ring->capacity);
+		iovs[i].iov_len = ring->capacity;
+		memset(&hdrs[i], 0, sizeof(struct mmsghdr));
+		hdrs[i].msg_hdr.msg_name = &ring->addrs[i];
+		hdrs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in6);
+		hdrs[i].msg_hdr.msg_iov = &iovs[i];
+		hdrs[i].msg_hdr.msg_iovlen = 1;
+		hdrs[i].msg_hdr.msg_control = ring->control + (i * MDNS_RX_CONTROL);
+		hdrs[i].msg_hdr.msg_controllen = MDNS_RX_CONTROL;
+	}
+	ring->drops = 0;
+	int ret = recvmmsg(sock, hdrs, (unsigned int)ring->slots, MSG_DONTWAIT, 0);
+	if (ret <= 0)
+		return 0;
+	for (int i = 0; i < ret; ++i) {
+		ring->lengths[i] = hdrs[i].msg_len;
+		ring->ifindex[i] = 0;
+		ring->stamps[i] = 0;
+		for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdrs[i].msg_hdr); cmsg;
+		     cmsg = CMSG_NXTHDR(&hdrs[i].msg_hdr, cmsg)) {
+			if ((cmsg->cmsg_level == IPPROTO_IP) && (cmsg->cmsg_type == IP_PKTINFO)) {
+				struct in_pktinfo pi;
+				memcpy(&pi, CMSG_DATA(cmsg), sizeof(pi));
+				ring->ifindex[i] = (unsigned)pi.ipi_ifindex;
+			}
+			else if ((cmsg->cmsg_level == IPPROTO_IPV6) && (cmsg->cmsg_type == IPV6_PKTINFO)) {
+				struct in6_pktinfo pi;
+				memcpy(&pi, CMSG_DATA(cmsg), sizeof(pi));
+				ring->ifindex[i] = pi.ipi6_ifindex;
+			}
+#ifdef SO_RXQ_OVFL
+			else if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SO_RXQ_OVFL)) {
+				// the later datagram has the later count
+				memcpy(&ring->drops, CMSG_DATA(cmsg), sizeof(ring->drops));
+			}
+#endif
+#ifdef SO_TIMESTAMPNS
+			else if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_TIMESTAMPNS)) {
+				struct timespec ts;
+				memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+				ring->stamps[i] = (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+			}
+#endif
+		}
+	}
+	received = (size_t)ret;
+#else
+	ring->drops = 0;
+	while (received < ring->slots) {
+		socklen_t addrlen = sizeof(struct sockaddr_in6);
+		int ret = recvfrom(sock, ring->buffers + (received * ring->capacity), ring->capacity, 0,
+		                   (struct sockaddr*)&ring->addrs[received], &addrlen);
+		if (ret <= 0)
+			break;
+		ring->ifindex[received] = 0;
+		ring->stamps[received] = 0;
+		ring->lengths[received++] = (size_t)ret;
+	}
+#endif
+	return received;
+}
 
-    // flags=8400 => response
-	if ( /*(transaction_id != tid) ||*/ (flags != 0x8400)) {
-        printf("%s: not my answer (tid 0x%04x ? 0x%04x) (flags 0x%04x)\n", __func__, tid, transaction_id, flags);
-		return 0; //Not a reply to our last question
-    }
+size_t
+mdns_packet_parse(const struct sockaddr* saddr, uint16_t tid, const uint8_t* buffer, size_t data_size,
+                  mdns_record_callback_fn callback, mdns_parse_status* status) {
+	return mdns_packet_parse<const mdns_record_callback_fn&>(saddr, tid, buffer, data_size, callback, status);
+}
 
-	if (questions > 1) {
-        printf("%s: too many questions (%d) \n", __func__, questions);
+size_t
+mdns_record_rdata_expand(const uint8_t* buffer, size_t size, size_t offset, size_t length, uint16_t type,
+                         uint8_t* rdata, size_t capacity) {
+	if (size < offset + length)
 		return 0;
-    }
-
-    mdns_string_t question;
-    char qstr[256];
-	for (int i = 0; i < questions; ++i) {
-		size_t ofs = (size_t)((char*)data - (char*)buffer);
-        question = mdns_string_extract(buffer, data_size, &ofs, qstr, sizeof(qstr));
-		data = (uint16_t*)((char*)buffer + ofs);
-		++data;
-		++data;
-	}
-
-	size_t records = 0;
-	size_t offset = (size_t)((char*)data - (char*)buffer);
-
-    size_t nAns=0, nAuth=0, nAddl=0;
-    
-    if (transaction_id==0 && false) { // discovery
-        // XXX-ELH: pasted from mdns_discovery_recv;
-        //          should be re-factored and added in to the regular answer parser
-        mdns_string_t sq = { "_services._dns-sd._udp.local.", sizeof(mdns_services_query) };
-        int do_callback = 1;
-        for (unsigned i = 0; i < answer_rrs; ++i) {
-            size_t ofs = (size_t)((char*)data - (char*)buffer);
-            size_t verify_ofs = 12;
-            //Verify it's an answer to our question, _services._dns-sd._udp.local.
-            int is_answer = mdns_string_equal(buffer, data_size, &ofs,
-                                              mdns_services_query, sizeof(mdns_services_query), &verify_ofs);
-            data = (uint16_t*)(buffer + ofs);
-
-            uint16_t type = ntohs(*data++);
-            uint16_t rclass = ntohs(*data++);
-            uint32_t ttl = ntohl(*(uint32_t*)(uint8_t*)data); data += 2;
-            uint16_t length = ntohs(*data++);
-
-            if (is_answer && do_callback) {
-                size_t offset = ((uint8_t*)data)-buffer;
-                ++records;
-                if (callback(saddr, sq, mdns_entrytype::ANSWER, type, rclass, ttl, buffer, capacity, offset, length))
-                    do_callback = 0;
-            }
-            data = (uint16_t*)((char*)data + length);
-        }
-
-    } else {
-        nAns = mdns_records_parse(saddr, question, buffer, data_size, &offset,
-                                  mdns_entrytype::ANSWER, answer_rrs, callback);
-    }
-    nAuth = mdns_records_parse(saddr, question, buffer, data_size, &offset,
-                               mdns_entrytype::AUTHORITY, authority_rrs, callback);
-	nAddl = mdns_records_parse(saddr, question, buffer, data_size, &offset,
-                               mdns_entrytype::ADDITIONAL, additional_rrs, callback);
-    records = nAns + nAuth + nAddl;
-    if (records==0) {
-        printf("%s: (ans %lu) (auth %lu) (addl %lu) (records %lu)\n", __func__,
-               nAns, nAuth, nAddl, records);
-        hexdump(0, buffer, data_size);
-    }
-    return records;
+	char namebuffer[256];
+	uint8_t* end;
+	switch (type) {
+	case mdns_recordtype::PTR: {
+		mdns_string_t name = mdns_record_parse_ptr(buffer, size, offset, length, namebuffer, sizeof(namebuffer));
+		end = mdns_string_make(rdata, capacity, name.str, name.length);
+		return end ? (size_t)(end - rdata) : 0;
+	}
+	case mdns_recordtype::SRV: {
+		if ((length < 8) || (capacity < 6))
+			return 0;
+		mdns_record_srv_t srv = mdns_record_parse_srv(buffer, size, offset, length, namebuffer, sizeof(namebuffer));
+		memcpy(rdata, buffer + offset, 6);
+		end = mdns_string_make(rdata + 6, capacity - 6, srv.name.str, srv.name.length);
+		return end ? (size_t)(end - rdata) : 0;
+	}
+	default:
+		if (length > capacity)
+			return 0;
+		memcpy(rdata, buffer + offset, length);
+		return length;
+	}
 }
 
 mdns_string_t
@@ -595,10 +1243,10 @@ mdns_record_parse_srv(const uint8_t* buffer, size_t size, size_t offset, size_t
 	// 2 bytes network-order unsigned port
 	// string: discovery (domain) name, minimum 2 bytes when compressed
 	if ((size >= offset + length) && (length >= 8)) {
-		const uint16_t* recorddata = (const uint16_t*)((const char*)buffer + offset);
-		srv.priority = ntohs(*recorddata++);
-		srv.weight = ntohs(*recorddata++);
-		srv.port = ntohs(*recorddata++);
+		const uint8_t* recorddata = buffer + offset;
+		srv.priority = (uint16_t)((recorddata[0] << 8) | recorddata[1]);
+		srv.weight = (uint16_t)((recorddata[2] << 8) | recorddata[3]);
+		srv.port = (uint16_t)((recorddata[4] << 8) | recorddata[5]);
 		offset += 6;
 		srv.name = mdns_string_extract(buffer, size, &offset, strbuffer, capacity);
 	}
@@ -614,7 +1262,7 @@ mdns_record_parse_a(const uint8_t* buffer, size_t size, size_t offset, size_t le
 	addr->sin_len = sizeof(struct sockaddr_in);
 #endif
 	if ((size >= offset + length) && (length == 4))
-		addr->sin_addr.s_addr = *(const uint32_t*)((const char*)buffer + offset);
+		memcpy(&addr->sin_addr, buffer + offset, 4);
 	return addr;
 }
 
@@ -627,7 +1275,7 @@ mdns_record_parse_aaaa(const uint8_t* buffer, size_t size, size_t offset, size_t
 	addr->sin6_len = sizeof(struct sockaddr_in6);
 #endif
 	if ((size >= offset + length) && (length == 16))
-		addr->sin6_addr = *(const struct in6_addr*)((const char*)buffer + offset);
+		memcpy(&addr->sin6_addr, buffer + offset, 16);
     name->str="";
     name->length=0;
 	return addr;
@@ -650,12 +1298,17 @@ mdns_record_parse_txt(const uint8_t* buffer, size_t size, size_t offset, size_t
 
 		++strdata;
 		offset += sublength + 1;
+		if (offset > end)
+			break;
 
-		separator = 0;
+		//no '=': a boolean attribute (RFC 6763 section 6.4); an empty key is skipped
+		separator = sublength;
 		for (size_t c = 0; c < sublength; ++c) {
 			//DNS-SD TXT record keys MUST be printable US-ASCII, [0x20, 0x7E]
-			if ((strdata[c] < 0x20) || (strdata[c] > 0x7E))
+			if ((strdata[c] < 0x20) || (strdata[c] > 0x7E)) {
+				separator = 0;
 				break;
+			}
 			if (strdata[c] == '=') {
 				separator = c;
 				break;
@@ -674,6 +1327,8 @@ mdns_record_parse_txt(const uint8_t* buffer, size_t size, size_t offset, size_t
 		else {
 			records[parsed].key.str = strdata;
 			records[parsed].key.length = sublength;
+			records[parsed].value.str = strdata + sublength;
+			records[parsed].value.length = 0;
 		}
 
 		++parsed;
@@ -15,12 +15,20 @@
 
 #include <stddef.h>    // for size_t
 #include <stdint.h>    // for uint8_t, uint16_t, uint32_t
+#include <string.h>    // for memset
+#include <sys/socket.h>  // for recvfrom
+#include <netinet/in.h>  // for sockaddr_in6
+#include <time.h>      // for timespec
 #include <functional>  // for function
 #include <iosfwd>      // for string
+#include <utility>     // for forward
 #include "mdns.h"      // for mdns_recordtype, mdns_entrytype
 
 #define MDNS_INVALID_POS ((size_t)-1)
 
+// A name is at most 255 octets, so at most 127 labels plus the root; more means a pointer loop
+#define MDNS_MAX_LABELS 128
+
 #define MDNS_STRING_CONST(s) (s), (sizeof((s))-1)
 #define MDNS_STRING_FORMAT(s) (int)((s).length), s.str
 
@@ -52,16 +60,118 @@ struct mdns_record_txt_t {
 	mdns_string_t value;
 };
 
+// Largest datagram we build: a 1500 byte Ethernet MTU less IPv6 and UDP headers
+#define MDNS_PACKET_MTU 1452
+
+// Offsets of names already written to a packet, for RFC 1035 suffix compression
+#define MDNS_NAME_TABLE_SIZE 64
+struct mdns_name_table_t {
+	size_t count;
+	uint16_t offsets[MDNS_NAME_TABLE_SIZE];
+};
+
+struct mdns_query_t {
+	mdns_recordtype type;
+	const char* name;
+	size_t length;
+};
+
+// Resource record to write; rdata is in wire form with any names uncompressed
+struct mdns_record_t {
+	const char* name;
+	size_t length;
+	uint16_t type;
+	uint16_t rclass;
+	uint32_t ttl;
+	const uint8_t* rdata;
+	size_t rdata_length;
+};
+
+// Packet writer: questions, then records in section order, every name (including those
+// inside PTR and SRV rdata) compressed against what is already in the packet.
+// A call that does not fit returns -1 and leaves the packet as it was.
+struct mdns_writer_t {
+	uint8_t* buffer;
+	size_t capacity;
+	uint8_t* dest;
+	mdns_name_table_t table;
+	int section;          // last mdns_entrytype written, 0 while writing questions
+	uint16_t counts[4];   // questions, then per mdns_entrytype
+};
+
+// Default depth of a receive ring, i.e. datagrams drained per socket per wakeup
+#define MDNS_RX_BATCH 32
+
+// Ancillary data space per received datagram
+#define MDNS_RX_CONTROL 128
+
+// Preallocated receive ring for mdns_recv_batch; slot i holds lengths[i] bytes
+// at buffers + i*capacity, sent from addrs[i] and received on interface ifindex[i]
+// (0 where the platform does not report it) at stamps[i], the kernel's arrival time
+// (SO_TIMESTAMPNS, on the mdns_time_ns() clock; 0 where not reported).  drops is the
+// socket's running count of datagrams the kernel dropped for want of buffer space
+// (SO_RXQ_OVFL), as of the last batch; 0 when none was reported, which the kernel only
+// does once there are some.
+struct mdns_rxring_t {
+	size_t slots;
+	size_t capacity;
+	uint8_t* buffers;
+	struct sockaddr_in6* addrs;
+	size_t* lengths;
+	unsigned* ifindex;
+	uint64_t* stamps;
+	uint32_t drops;
+	void* hdrs;        // struct mmsghdr[slots] (linux)
+	void* iovs;        // struct iovec[slots] (linux)
+	uint8_t* control;  // MDNS_RX_CONTROL bytes per slot (linux)
+};
+
+// Most datagrams a transmit ring holds, i.e. handed to the kernel by one mdns_txring_send
+#define MDNS_TX_BURST 8
+
+// Preallocated transmit ring: count packets, packet i being lengths[i] bytes at buffers[i].
+// Built once, then sent to any number of sockets with mdns_txring_send.
+struct mdns_txring_t {
+	size_t count;
+	size_t lengths[MDNS_TX_BURST];
+	uint8_t buffers[MDNS_TX_BURST][MDNS_PACKET_MTU];
+};
+
 int mdns_socket_open_ipv4(void);
 
 int mdns_socket_setup_ipv4(int sock);
 
+// ifindex 0: default interface, as mdns_socket_open_ipv4()
+int mdns_socket_open_ipv4_if(unsigned ifindex);
+
+int mdns_socket_setup_ipv4_if(int sock, unsigned ifindex);
+
+// bound to port 5353 (shared) for answering queries, see MdnsResponder
+int mdns_socket_open_ipv4_service(unsigned ifindex);
+
 int mdns_socket_open_ipv6(void);
 
 int mdns_socket_setup_ipv6(int sock);
 
+int mdns_socket_open_ipv6_if(unsigned ifindex);
+
+int mdns_socket_setup_ipv6_if(int sock, unsigned ifindex);
+
+int mdns_socket_open_ipv6_service(unsigned ifindex);
+
 void mdns_socket_close(int sock);
 
+// Request SO_RCVBUF/SO_SNDBUF sizes in bytes (0: leave as is), over the system limit where
+// privileged (SO_RCVBUFFORCE/SO_SNDBUFFORCE); 0 or -1. The kernel may round or cap them:
+// mdns_socket_buffers_get() has what was granted.
+int mdns_socket_buffers(int sock, int rcvbuf, int sndbuf);
+
+int mdns_socket_buffers_get(int sock, int* rcvbuf, int* sndbuf);
+
+// Wall clock (CLOCK_REALTIME) in ns since the epoch, the clock received datagrams are
+// stamped with: a send time taken from it is comparable with mdns_rxring_t::stamps
+uint64_t mdns_time_ns(void);
+
 int mdns_discovery_send(int sock);
 
 int mdns_query_send(int sock, uint16_t tid, mdns_recordtype type, const char* name, size_t length);
@@ -70,8 +180,58 @@ inline int mdns_query_send(int sock, uint16_t tid, mdns_recordtype type, const s
     return mdns_query_send(sock, tid, type, name.c_str(), name.size());
 }
 
+// Pack all queries into as few MDNS_PACKET_MTU datagrams as possible; returns datagrams sent or -1
+int mdns_multiquery_send(int sock, uint16_t tid, const mdns_query_t* queries, size_t count);
+
+// As mdns_multiquery_send, with answers in the Answer section for known-answer suppression;
+// answers that do not fit spill into further packets with the TC bit set on all but the last
+int mdns_multiquery_send_known(int sock, uint16_t tid, const mdns_query_t* queries, size_t count,
+                               const mdns_record_t* answers, size_t nanswers);
+
 size_t mdns_recv(int sock, uint16_t tid, uint8_t* buffer, size_t capacity, mdns_record_callback_fn callback);
 
+// As above with any callable taking the mdns_record_callback_fn arguments, called directly
+// so it can be inlined into the record loop; see the end of this file
+template<typename F>
+size_t mdns_recv(int sock, uint16_t tid, uint8_t* buffer, size_t capacity, F&& callback);
+
+int mdns_rxring_init(mdns_rxring_t* ring, size_t slots, size_t capacity);
+
+void mdns_rxring_free(mdns_rxring_t* ring);
+
+// Drain up to ring->slots datagrams from sock with a single recvmmsg; returns the number received
+size_t mdns_recv_batch(int sock, mdns_rxring_t* ring);
+
+// The mDNS group and port for family (AF_INET or AF_INET6) in storage; returns its length
+socklen_t mdns_multicast_group(int family, struct sockaddr_in6* storage);
+
+void mdns_txring_clear(mdns_txring_t* ring);
+
+// Append the packets mdns_multiquery_send_known would send; returns how many, or -1
+// (appending nothing) if they do not fit the ring
+int mdns_txring_query(mdns_txring_t* ring, uint16_t tid, const mdns_query_t* queries, size_t count,
+                      const mdns_record_t* answers, size_t nanswers);
+
+// Append the DNS-SD service enumeration query mdns_discovery_send sends; 0 or -1
+int mdns_txring_discovery(mdns_txring_t* ring);
+
+// Send every packet in the ring to "to" with a single sendmmsg (sendto elsewhere), leaving
+// the ring as it is for further sockets; returns the number sent or -1
+int mdns_txring_send(int sock, const mdns_txring_t* ring, const struct sockaddr* to, socklen_t tolen);
+
+// Parse one mDNS response from buffer as if received from "from"; no socket needed.
+// Returns the number of records delivered to callback; status (optional) says why it stopped.
+size_t mdns_packet_parse(const struct sockaddr* from, uint16_t tid, const uint8_t* buffer, size_t size,
+                         mdns_record_callback_fn callback, mdns_parse_status* status = 0);
+
+// As above with any callable taking the mdns_record_callback_fn arguments: no std::function,
+// no allocation, and the record handler can be inlined into the parser.  A lambda argument
+// picks this one; an mdns_record_callback_fn picks the one above.  sections (optional, 3
+// entries) gets the records delivered from the answer, authority and additional sections.
+template<typename F>
+size_t mdns_packet_parse(const struct sockaddr* from, uint16_t tid, const uint8_t* buffer, size_t size,
+                         F&& callback, mdns_parse_status* status = 0, size_t* sections = 0);
+
 mdns_string_t mdns_string_extract(const uint8_t* buffer, size_t size, size_t* offset,
                                   char* str, size_t capacity);
 
@@ -82,6 +242,44 @@ int mdns_string_equal(const uint8_t* buffer_lhs, size_t size_lhs, size_t* ofs_lh
 
 uint8_t *mdns_string_make(uint8_t* data, size_t capacity, const char* name, size_t length);
 
+// Lowercased copy of name without a trailing dot, for case-insensitive lookups
+mdns_string_t mdns_string_key(const char* name, size_t length, char* str, size_t capacity);
+
+// Write name at dest inside packet (capacity bytes from packet), replacing any suffix already
+// recorded in table with a compression pointer; returns the end of the name or 0 if it does not fit
+uint8_t *mdns_string_make_compressed(uint8_t* packet, size_t capacity, uint8_t* dest, const char* name,
+                                     size_t length, mdns_name_table_t* table);
+
+// Append record at dest inside packet (capacity bytes from packet); returns its end or 0 if it does not fit.
+// Names in PTR and SRV rdata are written compressed.
+uint8_t *mdns_record_make(uint8_t* packet, size_t capacity, uint8_t* dest, const mdns_record_t* record,
+                          mdns_name_table_t* table);
+
+void mdns_writer_init(mdns_writer_t* writer, uint8_t* buffer, size_t capacity, uint16_t tid, uint16_t flags);
+
+int mdns_writer_question(mdns_writer_t* writer, const char* name, size_t length, uint16_t type, uint16_t qclass);
+
+int mdns_writer_record(mdns_writer_t* writer, mdns_entrytype section, const mdns_record_t* record);
+
+int mdns_writer_a(mdns_writer_t* writer, mdns_entrytype section, const char* name, size_t length,
+                  uint16_t rclass, uint32_t ttl, const struct in_addr* addr);
+
+int mdns_writer_aaaa(mdns_writer_t* writer, mdns_entrytype section, const char* name, size_t length,
+                     uint16_t rclass, uint32_t ttl, const struct in6_addr* addr);
+
+int mdns_writer_ptr(mdns_writer_t* writer, mdns_entrytype section, const char* name, size_t length,
+                    uint16_t rclass, uint32_t ttl, const char* target, size_t target_length);
+
+int mdns_writer_srv(mdns_writer_t* writer, mdns_entrytype section, const char* name, size_t length,
+                    uint16_t rclass, uint32_t ttl, uint16_t priority, uint16_t weight, uint16_t port,
+                    const char* target, size_t target_length);
+
+int mdns_writer_txt(mdns_writer_t* writer, mdns_entrytype section, const char* name, size_t length,
+                    uint16_t rclass, uint32_t ttl, const mdns_record_txt_t* txt, size_t count);
+
+// Fill in the header counts; returns the packet length
+size_t mdns_writer_finish(mdns_writer_t* writer);
+
 mdns_string_t mdns_record_parse_ptr(const uint8_t* buffer, size_t size, size_t offset, size_t length,
                                     char* strbuffer, size_t capacity);
 
@@ -94,6 +292,10 @@ struct sockaddr_in* mdns_record_parse_a(const uint8_t* buffer, size_t size, size
 struct sockaddr_in6* mdns_record_parse_aaaa(const uint8_t* buffer, size_t size, size_t offset, size_t length,
                                             mdns_string_t *name, struct sockaddr_in6* addr);
 
+// Copy rdata with any embedded (PTR/SRV) names expanded, so it no longer refers to the packet
+size_t mdns_record_rdata_expand(const uint8_t* buffer, size_t size, size_t offset, size_t length, uint16_t type,
+                                uint8_t* rdata, size_t capacity);
+
 size_t mdns_record_parse_txt(const uint8_t* buffer, size_t size, size_t offset, size_t length,
                              mdns_record_txt_t* records, size_t capacity);
 
@@ -121,4 +323,143 @@ hexdump(uint32_t addr, const uint8_t* data, unsigned size, FILE* fp=stdout, unsi
     }
 }
 
+/* Parse loop, templated on the record callback */
+
+template<typename F>
+size_t
+mdns_records_parse(const struct sockaddr* from, const uint8_t* buffer, size_t size, size_t* offset,
+                   mdns_entrytype type, size_t records, F& callback, mdns_parse_status* status) {
+	size_t parsed = 0;
+	int do_callback = 1;
+	char namebuffer[256];
+	for (size_t i = 0; i < records; ++i) {
+		// the record's owner name is handed to the callback as its "question"
+		size_t name_offset = *offset;
+		if (!mdns_string_skip(buffer, size, &name_offset)) {
+			*status = mdns_parse_status::MALFORMED;
+			break;
+		}
+		if (name_offset + 10 > size) {
+			*status = mdns_parse_status::TRUNCATED;
+			break;
+		}
+		mdns_string_t name = mdns_string_extract(buffer, size, offset, namebuffer, sizeof(namebuffer));
+		if (*offset != name_offset) {
+			// the pointers lead somewhere skip does not follow: out of bounds or a loop
+			*status = mdns_parse_status::MALFORMED;
+			break;
+		}
+		const uint8_t* data = buffer + name_offset;
+
+		uint16_t rtype = (uint16_t)((data[0] << 8) | data[1]);
+		uint16_t rclass = (uint16_t)((data[2] << 8) | data[3]);
+		uint32_t ttl = ((uint32_t)data[4] << 24) | ((uint32_t)data[5] << 16) | ((uint32_t)data[6] << 8) | data[7];
+		uint16_t length = (uint16_t)((data[8] << 8) | data[9]);
+
+		*offset = name_offset + 10;
+		if (*offset + length > size) {
+			*status = mdns_parse_status::TRUNCATED;
+			break;
+		}
+
+		if (do_callback) {
+			++parsed;
+			if (callback(from, name, type, rtype, rclass, ttl, buffer, size, (*offset), length))
+				do_callback = 0;
+		}
+
+		*offset += length;
+	}
+	return parsed;
+}
+
+template<typename F>
+size_t
+mdns_packet_parse(const struct sockaddr* saddr, uint16_t tid, const uint8_t* buffer, size_t data_size,
+                  F&& callback, mdns_parse_status* status, size_t* sections) {
+	mdns_parse_status local_status;
+	if (!status)
+		status = &local_status;
+	if (sections)
+		sections[0] = sections[1] = sections[2] = 0;
+	*status = mdns_parse_status::OK;
+	if (data_size < 12) {
+		*status = mdns_parse_status::TRUNCATED;
+		return 0;
+	}
+
+	uint16_t transaction_id = (uint16_t)((buffer[0] << 8) | buffer[1]);
+	uint16_t flags          = (uint16_t)((buffer[2] << 8) | buffer[3]);
+	uint16_t questions      = (uint16_t)((buffer[4] << 8) | buffer[5]);
+	uint16_t answer_rrs     = (uint16_t)((buffer[6] << 8) | buffer[7]);
+	uint16_t authority_rrs  = (uint16_t)((buffer[8] << 8) | buffer[9]);
+	uint16_t additional_rrs = (uint16_t)((buffer[10] << 8) | buffer[11]);
+
+	// responses only: QR set, opcode and rcode zero (RFC 6762 sections 18.3 and 18.11)
+	if ((flags & 0xF80F) != 0x8000) {
+#ifdef MDNS_DEBUG
+		printf("%s: not my answer (tid 0x%04x ? 0x%04x) (flags 0x%04x)\n", __func__, tid, transaction_id, flags);
+#endif
+		(void)tid;
+		(void)transaction_id;
+		*status = mdns_parse_status::NOT_RESPONSE;
+		return 0;
+	}
+
+	size_t offset = 12;
+	for (int i = 0; i < questions; ++i) {
+		if (!mdns_string_skip(buffer, data_size, &offset)) {
+			*status = mdns_parse_status::MALFORMED;
+			return 0;
+		}
+		offset += 4;
+		if (offset > data_size) {
+			*status = mdns_parse_status::TRUNCATED;
+			return 0;
+		}
+	}
+
+	size_t nAns = 0, nAuth = 0, nAddl = 0;
+	nAns = mdns_records_parse(saddr, buffer, data_size, &offset,
+	                          mdns_entrytype::ANSWER, answer_rrs, callback, status);
+	if (*status == mdns_parse_status::OK)
+		nAuth = mdns_records_parse(saddr, buffer, data_size, &offset,
+		                           mdns_entrytype::AUTHORITY, authority_rrs, callback, status);
+	if (*status == mdns_parse_status::OK)
+		nAddl = mdns_records_parse(saddr, buffer, data_size, &offset,
+		                           mdns_entrytype::ADDITIONAL, additional_rrs, callback, status);
+	size_t records = nAns + nAuth + nAddl;
+	if (sections) {
+		sections[0] = nAns;
+		sections[1] = nAuth;
+		sections[2] = nAddl;
+	}
+#ifdef MDNS_DEBUG
+	if ((records == 0) || (*status != mdns_parse_status::OK)) {
+		printf("%s: (ans %lu) (auth %lu) (addl %lu) (records %lu) (status %d)\n", __func__,
+		       nAns, nAuth, nAddl, records, (int)*status);
+		hexdump(0, buffer, data_size);
+	}
+#endif
+	return records;
+}
+
+template<typename F>
+size_t
+mdns_recv(int sock, uint16_t tid, uint8_t* buffer, size_t capacity, F&& callback) {
+	struct sockaddr_in6 addr;
+	struct sockaddr* saddr = (struct sockaddr*)&addr;
+	memset(&addr, 0, sizeof(addr));
+	saddr->sa_family = AF_INET;
+#ifdef __APPLE__
+	saddr->sa_len = sizeof(addr);
+#endif
+	socklen_t addrlen = sizeof(addr);
+	int ret = recvfrom(sock, buffer, capacity, 0, saddr, &addrlen);
+	if (ret <= 0)
+		return 0;
+
+	return mdns_packet_parse<F>(saddr, tid, buffer, (size_t)ret, std::forward<F>(callback));
+}
+
 /* end: mdns_c.h */
@@ -0,0 +1,229 @@
+/********************************************************************************
+ * file: /github:elhernes/libmdns/mdns_cache.cpp
+ *
+ * born-on: Sun Oct 18 2026
+ * creator: Eric L. Hernes
+ *
+ * RFC 6762 section 10 record cache, keyed by (name, type, class); records
+ * sit on a timer wheel so expiry only touches what is due
+ *
+ */
+
+#include "mdns_cache.h"
+#include "mdns_c.h"  // for mdns_string_key
+
+namespace {
+    const uint16_t skCacheFlush = 0x8000;
+
+    std::string_view
+    cacheKey(std::string_view name, char *buf, size_t capacity) {
+        mdns_string_t k = mdns_string_key(name.data(), name.size(), buf, capacity);
+        return std::string_view(k.str, k.length);
+    }
+}
+
+constexpr std::chrono::milliseconds MdnsCache::kTick;
+
+MdnsCache::MdnsCache() : m_epoch(clock::now()), m_size(0), m_hits(0), m_misses(0) {
+}
+
+// wheel tick for t: expiry rounds up so a record is never dropped early, the clock rounds down
+uint64_t
+MdnsCache::ticks(clock::time_point t, bool roundUp) const {
+    if (t <= m_epoch) {
+        return 0;
+    }
+    auto d = t - m_epoch;
+    if (roundUp) {
+        d += kTick - clock::duration(1);
+    }
+    return (uint64_t)(d / kTick);
+}
+
+// (re)position r on the wheel after its expiry changed; m_mutex held
+void
+MdnsCache::schedule(Record &r) {
+    m_wheel.insert(&r, ticks(r.entry.expires, true));
+}
+
+std::string
+MdnsCache::key(std::string_view name) {
+    char buf[256];
+    return std::string(cacheKey(name, buf, sizeof(buf)));
+}
+
+void
+MdnsCache::insert(const MdnsRecordView &rec, uint16_t rclass, uint32_t ttl, std::string_view rdata,
+                  clock::time_point now) {
+    char buf[256];
+    std::string_view k = cacheKey(rec.question, buf, sizeof(buf));
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto ni = m_names.find(k);
+    if (ni == m_names.end()) {
+        if (ttl == 0) {
+            return; // goodbye for something we never had
+        }
+        ni = m_names.emplace(std::string(k), Records()).first;
+    }
+
+    bool flush = (rclass & skCacheFlush)!=0;
+    rclass &= ~skCacheFlush;
+
+    Record *found = nullptr;
+    for(auto &r : ni->second) {
+        Entry &e = r.entry;
+        if (e.rtype != rec.rtype || e.rclass != rclass) {
+            continue;
+        }
+        if (e.rdata == rdata) {
+            found = &r;
+        } else if (flush && now - e.received > std::chrono::seconds(1)) {
+            // section 10.2: other rdata for a unique record set goes away in one second
+            auto t = now + std::chrono::seconds(1);
+            if (t < e.expires) {
+                e.expires = t;
+                schedule(r);
+            }
+        }
+    }
+
+    if (ttl == 0) {
+        // section 10.1: a goodbye is a TTL of one second
+        if (found) {
+            found->entry.ttl = 1;
+            found->entry.received = now;
+            found->entry.expires = now + std::chrono::seconds(1);
+            schedule(*found);
+        }
+        return;
+    }
+
+    if (!found) {
+        ni->second.emplace_back();
+        found = &ni->second.back();
+        found->name = &ni->first;
+        found->entry.rtype = rec.rtype;
+        found->entry.rclass = rclass;
+        found->entry.rdata = rdata;
+        m_size++;
+    }
+    Entry &e = found->entry;
+    e.ttl = ttl;
+    e.received = now;
+    e.expires = now + std::chrono::seconds(ttl);
+    e.ip = rec.ip;
+    e.ifindex = rec.ifindex;
+    if (!rec.data.empty()) {
+        e.data = rec.data; // same rdata, same text: keep it through refreshes from text-less batches
+    }
+    schedule(*found);
+}
+
+size_t
+MdnsCache::lookup(mdns_recordtype type, const std::string &name, std::vector<MdnsRecord> &v,
+                  clock::time_point now) {
+    char buf[256];
+    size_t n=0;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto ni = m_names.find(cacheKey(name, buf, sizeof(buf)));
+    if (ni != m_names.end()) {
+        for(auto &r : ni->second) {
+            const Entry &e = r.entry;
+            if (e.rtype == type && e.expires > now) {
+                MdnsRecord rr;
+                rr.question = ni->first;
+                rr.etype = mdns_entry::ANSWER;
+                rr.rtype = type;
+                rr.ip = e.ip;
+                rr.data = e.data;
+                rr.ifindex = e.ifindex;
+                v.push_back(std::move(rr));
+                n++;
+            }
+        }
+    }
+    if (n>0) m_hits++; else m_misses++;
+    return n;
+}
+
+size_t
+MdnsCache::entries(mdns_recordtype type, const std::string &name, std::vector<Entry> &v,
+                   clock::time_point now) const {
+    char buf[256];
+    size_t n=0;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto ni = m_names.find(cacheKey(name, buf, sizeof(buf)));
+    if (ni != m_names.end()) {
+        for(auto &r : ni->second) {
+            if (r.entry.rtype == type && r.entry.expires > now) {
+                v.push_back(r.entry);
+                n++;
+            }
+        }
+    }
+    return n;
+}
+
+size_t
+MdnsCache::expire(clock::time_point now) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<Record*> due;
+    m_wheel.advance(ticks(now, false), [&due](MdnsTimerWheel::Node *n) {
+            due.push_back(static_cast<Record*>(n));
+        });
+    for(Record *r : due) {
+        auto ni = m_names.find(*r->name);
+        auto &rv = ni->second;
+        for(auto ri=rv.begin(); ri!=rv.end(); ri++) {
+            if (&*ri == r) {
+                rv.erase(ri);
+                break;
+            }
+        }
+        m_size--;
+        if (rv.empty()) {
+            m_names.erase(ni);
+        }
+    }
+    return due.size();
+}
+
+MdnsCache::clock::time_point
+MdnsCache::nextExpiry() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    uint64_t t = m_wheel.next();
+    if (t == MdnsTimerWheel::kNever) {
+        return clock::time_point::max();
+    }
+    return m_epoch + t*kTick;
+}
+
+void
+MdnsCache::clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for(auto &ni : m_names) {
+        for(auto &r : ni.second) {
+            m_wheel.cancel(&r);
+        }
+    }
+    m_names.clear();
+    m_size = 0;
+}
+
+size_t
+MdnsCache::size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_size;
+}
+
+/*
+ * Local Variables:
+ * mode: C++
+ * mode: font-lock
+ * c-basic-offset: 4
+ * tab-width: 8
+ * compile-command: "make.qmk"
+ * End:
+ */
+
+/* end of /github:elhernes/libmdns/mdns_cache.cpp */
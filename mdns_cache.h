@@ -0,0 +1,126 @@
+/********************************************************************************
+ * file: /github:elhernes/libmdns/mdns_cache.h
+ *
+ * born-on: Sun Oct 18 2026
+ * creator: Eric L. Hernes
+ *
+ * RFC 6762 section 10 record cache, keyed by (name, type, class); records
+ * sit on a timer wheel so expiry only touches what is due
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>    // for size_t
+#include <stdint.h>    // for uint16_t, uint32_t, uint64_t
+#include <chrono>
+#include <atomic>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "mdns.h"
+#include "mdns_c.h"    // for mdns_string_key
+#include "mdns_wheel.h"
+
+// safe to share between a receive thread and its consumers
+class MdnsCache {
+ public:
+    using clock = std::chrono::steady_clock;
+
+    struct Entry {
+        uint16_t rtype;
+        uint16_t rclass;       // cache-flush bit stripped
+        uint32_t ttl;          // as received, 1 after a goodbye
+        clock::time_point received;
+        clock::time_point expires;
+        std::string rdata;     // wire form, names uncompressed
+        std::string ip;        // responder
+        unsigned ifindex;      // interface it was last heard on
+        std::string data;      // as MdnsRecord::data
+    };
+
+    MdnsCache();
+
+    // add or refresh rec; ttl 0 (goodbye) expires the entry one second from now
+    void insert(const MdnsRecordView &rec, uint16_t rclass, uint32_t ttl, std::string_view rdata,
+                clock::time_point now=clock::now());
+
+    // append unexpired records for (type, name) as ANSWERs; counts a hit or a miss
+    size_t lookup(mdns_recordtype type, const std::string &name, std::vector<MdnsRecord> &v,
+                  clock::time_point now=clock::now());
+
+    // copies of the unexpired entries for (type, name), without touching the hit/miss counters
+    size_t entries(mdns_recordtype type, const std::string &name, std::vector<Entry> &v,
+                   clock::time_point now=clock::now()) const;
+
+    // f(const Entry &) on each unexpired entry for (type, name), in place under the cache
+    // lock: no copies, and f must not call back into the cache
+    template<typename F>
+    size_t visit(mdns_recordtype type, std::string_view name, F f, clock::time_point now=clock::now()) const {
+        char buf[256];
+        mdns_string_t k = mdns_string_key(name.data(), name.size(), buf, sizeof(buf));
+        size_t n=0;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto ni = m_names.find(std::string_view(k.str, k.length));
+        if (ni != m_names.end()) {
+            for(auto &r : ni->second) {
+                if (r.entry.rtype == type && r.entry.expires > now) {
+                    f(r.entry);
+                    n++;
+                }
+            }
+        }
+        return n;
+    }
+
+    // drop what has expired by now; costs only the records due
+    size_t expire(clock::time_point now=clock::now());
+    // when expire() next has work, to the wheel's granularity (early, never late); max() if empty
+    clock::time_point nextExpiry() const;
+    void clear();
+
+    size_t size() const;
+    uint64_t hits() const { return m_hits; }
+    uint64_t misses() const { return m_misses; }
+
+    // lowercase, no trailing dot
+    static std::string key(std::string_view name);
+
+ private:
+    // expiry wheel granularity
+    static constexpr std::chrono::milliseconds kTick{100};
+
+    struct Record : MdnsTimerWheel::Node {
+        const std::string *name;  // its m_names key
+        Entry entry;
+    };
+    using Records = std::list<Record>;
+
+    uint64_t ticks(clock::time_point t, bool roundUp) const;
+    void schedule(Record &r);
+
+ private:
+    mutable std::mutex m_mutex;
+    std::map<std::string, Records, std::less<> > m_names;
+    clock::time_point m_epoch;  // wheel tick 0
+    MdnsTimerWheel m_wheel;
+    size_t m_size;
+    std::atomic<uint64_t> m_hits;
+    std::atomic<uint64_t> m_misses;
+};
+
+/*
+ * Local Variables:
+ * mode: C++
+ * mode: font-lock
+ * c-basic-offset: 4
+ * tab-width: 8
+ * compile-command: "make.qmk"
+ * End:
+ */
+
+/* end of /github:elhernes/libmdns/mdns_cache.h */
@@ -0,0 +1,203 @@
+/********************************************************************************
+ * file: /github:elhernes/libmdns/mdns_coro.h
+ *
+ * born-on: Sun Oct 18 2026
+ * creator: Eric L. Hernes
+ *
+ * C++20 awaitable lookups: co_await MdnsAwait::host(rr, "box.local", 1s) and
+ * friends.  A lookup is a set of subscriptions plus one loop timer, so any
+ * number of them share the thread driving the instance's loop.  Empty unless
+ * compiled with coroutine support.
+ *
+ */
+
+#pragma once
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+
+#include <stddef.h>    // for size_t
+#include <stdint.h>    // for uint64_t
+#include <chrono>
+#include <coroutine>
+#include <memory>      // for shared_ptr
+#include <mutex>
+#include <string>
+#include <utility>     // for move
+#include <vector>
+
+#include "mdns.h"
+#include "mdns_cache.h"
+#include "mdns_loop.h"
+
+// Completes with the distinct answers to its questions once it has want of them,
+// or with what it has when the timeout passes. Cached answers count, and are
+// enough on their own when there are want of them. Someone must be running the
+// loop (runOnce() from the awaiting thread, or start()); the coroutine resumes on
+// the loop thread.
+class MdnsAwait {
+ public:
+    using clock = MdnsLoop::clock;
+    static const size_t kAll = (size_t)-1;
+
+    MdnsAwait(MdnsRR &rr, std::vector<MdnsQuestion> questions, size_t want, std::chrono::milliseconds timeout)
+        : m_state(std::make_shared<State>()) {
+        m_state->rr = &rr;
+        m_state->questions = std::move(questions);
+        m_state->want = want;
+        m_state->timeout = timeout;
+    }
+
+    // first n answers for (type, name)
+    static MdnsAwait answers(MdnsRR &rr, mdns_recordtype type, const std::string &name, size_t n,
+                             std::chrono::milliseconds timeout) {
+        return MdnsAwait(rr, { { type, name } }, n, timeout);
+    }
+
+    // the first address for host, A or AAAA, with any others that came with it
+    static MdnsAwait host(MdnsRR &rr, const std::string &name, std::chrono::milliseconds timeout) {
+        return MdnsAwait(rr, { { mdns_recordtype::A, name }, { mdns_recordtype::AAAA, name } }, 1, timeout);
+    }
+
+    // every instance of a service type (PTR) heard of within timeout
+    static MdnsAwait browse(MdnsRR &rr, const std::string &service, std::chrono::milliseconds timeout) {
+        return MdnsAwait(rr, { { mdns_recordtype::PTR, service } }, kAll, timeout);
+    }
+
+    MdnsAwait(MdnsAwait &&) = default;
+    MdnsAwait(const MdnsAwait &) = delete;
+    MdnsAwait &operator=(const MdnsAwait &) = delete;
+
+    // a coroutine destroyed (on the loop thread) while suspended here just drops the lookup
+    ~MdnsAwait() {
+        if (m_state && m_state->rr) {
+            {
+                std::lock_guard<std::mutex> lock(m_state->mutex);
+                m_state->handle = nullptr;
+            }
+            finish(m_state);
+        }
+    }
+
+    bool await_ready() {
+        std::vector<MdnsRecord> cached;
+        for(auto &q : m_state->questions) {
+            m_state->rr->lookup(q.type, q.name, cached);
+        }
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        for(auto &rr : cached) {
+            m_state->add(rr);
+        }
+        return m_state->answers.size() >= m_state->want;
+    }
+
+    void await_suspend(std::coroutine_handle<> h) {
+        // once subscribed, the loop thread may resume the coroutine (and so destroy this
+        // awaiter) before we return: work from a copy of the state from here on
+        std::shared_ptr<State> st = m_state;
+        st->handle = h;
+        auto deadline = clock::now() + st->timeout;
+        std::weak_ptr<State> ws = st;
+        std::vector<uint64_t> subs;
+        for(auto &q : st->questions) {
+            subs.push_back(st->rr->subscribe(q.name, q.type, [ws](const MdnsRecordView &rv) {
+                        if (auto s = ws.lock()) {
+                            bool full;
+                            {
+                                std::lock_guard<std::mutex> lock(s->mutex);
+                                full = !s->done && s->add(MdnsRecord(rv)) && s->answers.size() >= s->want;
+                            }
+                            if (full) finish(s);
+                        }
+                    }));
+        }
+        {
+            std::lock_guard<std::mutex> lock(st->mutex);
+            st->subs = subs;
+        }
+        st->rr->query(st->questions);
+        MdnsLoop &loop = st->rr->loop();
+        loop.post([st, deadline, &loop]() {
+                std::lock_guard<std::mutex> lock(st->mutex);
+                if (!st->done) {
+                    st->timer = loop.addTimer(deadline, [st]() { finish(st); });
+                }
+            });
+    }
+
+    std::vector<MdnsRecord> await_resume() {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        m_state->rr = nullptr; // nothing left to undo
+        return std::move(m_state->answers);
+    }
+
+ private:
+    struct State {
+        MdnsRR *rr = nullptr;
+        std::vector<MdnsQuestion> questions;
+        size_t want = kAll;
+        std::chrono::milliseconds timeout{0};
+        std::mutex mutex;
+        bool done = false;
+        std::vector<MdnsRecord> answers;
+        std::vector<uint64_t> subs;
+        MdnsLoop::TimerId timer = 0;  // loop thread only
+        std::coroutine_handle<> handle;
+
+        // false if rec is a repeat; mutex held
+        bool add(const MdnsRecord &rec) {
+            std::string key = MdnsCache::key(rec.question);
+            for(auto &a : answers) {
+                if (a.rtype == rec.rtype && a.data == rec.data && MdnsCache::key(a.question) == key) {
+                    return false;
+                }
+            }
+            answers.push_back(rec);
+            return true;
+        }
+    };
+
+    // first caller wins: drop the subscriptions, then cancel the timer and resume the
+    // coroutine, if it is still there, from the loop thread; never from inside a
+    // subscriber or the timer handler
+    static void finish(const std::shared_ptr<State> &st) {
+        std::vector<uint64_t> subs;
+        {
+            std::lock_guard<std::mutex> lock(st->mutex);
+            if (st->done) {
+                return;
+            }
+            st->done = true;
+            subs.swap(st->subs);
+        }
+        for(uint64_t id : subs) {
+            st->rr->unsubscribe(id);
+        }
+        MdnsLoop &loop = st->rr->loop();
+        loop.post([st, &loop]() {
+                if (st->timer) loop.cancelTimer(st->timer);
+                std::coroutine_handle<> h;
+                {
+                    std::lock_guard<std::mutex> lock(st->mutex);
+                    h = st->handle;
+                }
+                if (h) h.resume();
+            });
+    }
+
+ private:
+    std::shared_ptr<State> m_state;
+};
+
+#endif // __cpp_impl_coroutine
+
+/*
+ * Local Variables:
+ * mode: C++
+ * mode: font-lock
+ * c-basic-offset: 4
+ * tab-width: 8
+ * compile-command: "make.qmk"
+ * End:
+ */
+
+/* end of /github:elhernes/libmdns/mdns_coro.h */
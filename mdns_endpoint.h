@@ -0,0 +1,157 @@
+/********************************************************************************
+ * file: /github:elhernes/libmdns/mdns_endpoint.h
+ *
+ * born-on: Sun Oct 18 2026
+ * creator: Eric L. Hernes
+ *
+ * Compact binary form of a datagram's source address, and numeric IPv4/IPv6
+ * formatters that produce what getnameinfo(NI_NUMERICHOST) does without the
+ * trip through the resolver library.
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>    // for size_t
+#include <stdint.h>    // for uint8_t, uint16_t, uint32_t
+#include <string.h>    // for memcpy, memcmp
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>  // for ntohs
+
+// "a.b.c.d" from 4 network order bytes; buf needs 16, returns the length
+inline size_t
+mdns_format_ipv4(const uint8_t *a, char *buf) {
+    char *p = buf;
+    for(int i=0; i<4; i++) {
+        unsigned v = a[i];
+        if (v >= 100) {
+            *p++ = (char)('0' + v/100);
+            v %= 100;
+            *p++ = (char)('0' + v/10);
+        } else if (v >= 10) {
+            *p++ = (char)('0' + v/10);
+        }
+        *p++ = (char)('0' + v%10);
+        if (i<3) *p++ = '.';
+    }
+    *p = '\0';
+    return (size_t)(p - buf);
+}
+
+// RFC 5952 text from 16 network order bytes: lowercase, the longest run of two or more
+// zero groups as "::", IPv4-mapped (and, as glibc does, -compatible) tails dotted;
+// buf needs 46, returns the length
+inline size_t
+mdns_format_ipv6(const uint8_t *a, char *buf) {
+    static const char skHex[] = "0123456789abcdef";
+    uint16_t w[8];
+    for(int i=0; i<8; i++) {
+        w[i] = (uint16_t)(a[2*i]<<8 | a[2*i+1]);
+    }
+    int best=-1, bestLen=0;
+    for(int i=0; i<8; ) {
+        if (w[i]) {
+            i++;
+            continue;
+        }
+        int j=i;
+        while (j<8 && !w[j]) j++;
+        if (j-i > bestLen) {
+            best = i;
+            bestLen = j-i;
+        }
+        i = j;
+    }
+    if (bestLen < 2) {
+        best = -1;
+    }
+    char *p = buf;
+    for(int i=0; i<8; i++) {
+        if (best>=0 && i>=best && i<best+bestLen) {
+            if (i==best) *p++ = ':';
+            continue;
+        }
+        if (i) *p++ = ':';
+        if (i==6 && best==0 && (bestLen==6 || (bestLen==5 && w[5]==0xffff))) {
+            p += mdns_format_ipv4(a+12, p);
+            break;
+        }
+        bool lead = true;
+        for(int shift=12; shift>=0; shift-=4) {
+            unsigned d = (w[i] >> shift) & 0xf;
+            if (d || !lead || shift==0) {
+                *p++ = skHex[d];
+                lead = false;
+            }
+        }
+    }
+    if (best>=0 && best+bestLen==8) *p++ = ':';
+    *p = '\0';
+    return (size_t)(p - buf);
+}
+
+struct MdnsEndpoint {
+    static const size_t kMaxText = 64;  // room for format(): IPv6, '%' and a scope id
+
+    MdnsEndpoint() : family(0), port(0), scope(0), addr() {}
+    explicit MdnsEndpoint(const struct sockaddr *sa) : MdnsEndpoint() {
+        if (!sa) {
+            return;
+        }
+        if (sa->sa_family == AF_INET) {
+            const struct sockaddr_in *in = (const struct sockaddr_in*)sa;
+            family = AF_INET;
+            port = ntohs(in->sin_port);
+            memcpy(addr, &in->sin_addr, 4);
+        } else if (sa->sa_family == AF_INET6) {
+            const struct sockaddr_in6 *in6 = (const struct sockaddr_in6*)sa;
+            family = AF_INET6;
+            port = ntohs(in6->sin6_port);
+            scope = in6->sin6_scope_id;
+            memcpy(addr, &in6->sin6_addr, 16);
+        }
+    }
+
+    bool operator==(const MdnsEndpoint &o) const {
+        return family==o.family && port==o.port && scope==o.scope && memcmp(addr, o.addr, sizeof(addr))==0;
+    }
+    bool operator!=(const MdnsEndpoint &o) const { return !(*this == o); }
+
+    // numeric address without the port, scoped IPv6 as "fe80::1%2"; buf needs kMaxText,
+    // returns the length (0 for an unknown family)
+    size_t format(char *buf) const {
+        size_t n=0;
+        if (family == AF_INET) {
+            n = mdns_format_ipv4(addr, buf);
+        } else if (family == AF_INET6) {
+            n = mdns_format_ipv6(addr, buf);
+            if (scope) {
+                char digits[10];
+                size_t nd=0;
+                for(uint32_t s=scope; s; s/=10) digits[nd++] = (char)('0' + s%10);
+                buf[n++] = '%';
+                while (nd) buf[n++] = digits[--nd];
+            }
+        }
+        buf[n] = '\0';
+        return n;
+    }
+
+    uint8_t family;    // AF_INET, AF_INET6, or 0 if unknown
+    uint16_t port;     // host order
+    uint32_t scope;    // IPv6 scope id
+    uint8_t addr[16];  // network order; IPv4 in the first 4
+};
+
+/*
+ * Local Variables:
+ * mode: C++
+ * mode: font-lock
+ * c-basic-offset: 4
+ * tab-width: 8
+ * compile-command: "make.qmk"
+ * End:
+ */
+
+/* end of /github:elhernes/libmdns/mdns_endpoint.h */
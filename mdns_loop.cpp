@@ -0,0 +1,322 @@
+/********************************************************************************
+ * file: /github:elhernes/libmdns/mdns_loop.cpp
+ *
+ * born-on: Sun Oct 18 2026
+ * creator: Eric L. Hernes
+ *
+ * Event loop for mdns sockets and timers
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>   // for fcntl
+#include <stdio.h>   // for perror
+#include <string.h>  // for memset
+#include <unistd.h>  // for close, read
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#else
+#include <poll.h>
+#include <vector>
+#endif
+
+#include "mdns_loop.h"
+
+MdnsLoop::MdnsLoop() : m_epfd(-1), m_timerfd(-1), m_epoch(clock::now()), m_nextTimer(1) {
+    m_wakefd[0] = m_wakefd[1] = -1;
+#ifdef __linux__
+    m_epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epfd<0) {
+        perror("epoll_create1");
+    }
+    m_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+    if (m_timerfd<0) {
+        perror("timerfd_create");
+    } else {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = m_timerfd;
+        epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_timerfd, &ev);
+    }
+    m_wakefd[0] = m_wakefd[1] = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    if (m_wakefd[0]<0) {
+        perror("eventfd");
+    } else {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = m_wakefd[0];
+        epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_wakefd[0], &ev);
+    }
+#else
+    if (pipe(m_wakefd)) {
+        perror("pipe");
+        m_wakefd[0] = m_wakefd[1] = -1;
+    } else {
+        for(int fd : m_wakefd) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+    }
+#endif
+}
+
+MdnsLoop::~MdnsLoop() {
+    if (m_wakefd[0]>=0) close(m_wakefd[0]);
+    if (m_wakefd[1]>=0 && m_wakefd[1]!=m_wakefd[0]) close(m_wakefd[1]);
+    if (m_timerfd>=0) close(m_timerfd);
+    if (m_epfd>=0) close(m_epfd);
+}
+
+MdnsLoop &
+MdnsLoop::shared() {
+    static MdnsLoop sLoop;
+    return sLoop;
+}
+
+bool
+MdnsLoop::add(int fd, IoHandler handler) {
+    if (fd<0) {
+        return false;
+    }
+#ifdef __linux__
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    int op = m_io.count(fd) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(m_epfd, op, fd, &ev)) {
+        perror("epoll_ctl");
+        return false;
+    }
+#endif
+    m_io[fd] = std::make_shared<IoHandler>(handler);
+    return true;
+}
+
+void
+MdnsLoop::remove(int fd) {
+    if (m_io.erase(fd)) {
+#ifdef __linux__
+        epoll_ctl(m_epfd, EPOLL_CTL_DEL, fd, nullptr);
+#endif
+    }
+}
+
+// wheel tick for t: deadlines round up so nothing fires early, the clock rounds down
+uint64_t
+MdnsLoop::ticks(clock::time_point t, bool roundUp) const {
+    if (t <= m_epoch) {
+        return 0;
+    }
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t - m_epoch);
+    if (roundUp && m_epoch + ms < t) {
+        ms += std::chrono::milliseconds(1);
+    }
+    return (uint64_t)ms.count();
+}
+
+MdnsLoop::TimerId
+MdnsLoop::addTimer(clock::time_point deadline, TimerHandler handler) {
+    TimerId id = m_nextTimer++;
+    std::unique_ptr<Timer> t(new Timer);
+    t->id = id;
+    t->handler = handler;
+    m_wheel.insert(t.get(), ticks(deadline, true));
+    m_timers[id] = std::move(t);
+    armTimer();
+    return id;
+}
+
+bool
+MdnsLoop::cancelTimer(TimerId id) {
+    auto ti = m_timers.find(id);
+    if (ti == m_timers.end()) {
+        return false;
+    }
+    m_wheel.cancel(ti->second.get());
+    m_timers.erase(ti);
+    armTimer();
+    return true;
+}
+
+MdnsLoop::clock::time_point
+MdnsLoop::nextTimer() const {
+    uint64_t t = m_wheel.next();
+    if (t == MdnsTimerWheel::kNever) {
+        return clock::time_point::max();
+    }
+    return m_epoch + std::chrono::milliseconds(t);
+}
+
+void
+MdnsLoop::post(TimerHandler fn) {
+    {
+        std::lock_guard<std::mutex> lock(m_postMutex);
+        m_posted.push_back(fn);
+    }
+    wakeup();
+}
+
+void
+MdnsLoop::wakeup() {
+    uint64_t one=1;
+    if (m_wakefd[1]>=0 && write(m_wakefd[1], &one, m_wakefd[0]==m_wakefd[1] ? sizeof(one) : 1) < 0 &&
+        errno!=EAGAIN) {
+        perror("MdnsLoop::wakeup");
+    }
+}
+
+// drain the wakeup fd, then run whatever was posted
+void
+MdnsLoop::runPosted() {
+    uint8_t buf[64];
+    while (m_wakefd[0]>=0 && read(m_wakefd[0], buf, sizeof(buf)) > 0) {
+    }
+    std::vector<TimerHandler> posted;
+    {
+        std::lock_guard<std::mutex> lock(m_postMutex);
+        posted.swap(m_posted);
+    }
+    for(auto &fn : posted) {
+        fn();
+    }
+}
+
+// point the timerfd at the earliest deadline, or disarm it
+void
+MdnsLoop::armTimer() {
+#ifdef __linux__
+    if (m_timerfd<0) {
+        return;
+    }
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    auto next = nextTimer();
+    if (next != clock::time_point::max()) {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(next.time_since_epoch()).count();
+        if (ns<=0) ns=1; // zero would disarm
+        its.it_value.tv_sec = ns / 1000000000;
+        its.it_value.tv_nsec = ns % 1000000000;
+    }
+    timerfd_settime(m_timerfd, TFD_TIMER_ABSTIME, &its, nullptr);
+#endif
+}
+
+void
+MdnsLoop::fireTimers() {
+    if (m_timers.empty()) {
+        return;
+    }
+    // collect first: a handler may add or cancel timers, including ones due now
+    std::vector<TimerId> due;
+    m_wheel.advance(ticks(clock::now(), false), [&due](MdnsTimerWheel::Node *n) {
+            due.push_back(static_cast<Timer*>(n)->id);
+        });
+    for(TimerId id : due) {
+        auto ti = m_timers.find(id);
+        if (ti == m_timers.end()) {
+            continue; // cancelled by an earlier handler
+        }
+        TimerHandler h = std::move(ti->second->handler);
+        m_timers.erase(ti);
+        h();
+    }
+    armTimer();
+}
+
+bool
+MdnsLoop::wait(int msec) {
+#ifdef __linux__
+    struct epoll_event evs[16];
+    int n = epoll_wait(m_epfd, evs, sizeof(evs)/sizeof(evs[0]), msec);
+    if (n<0) {
+        return errno==EINTR;
+    }
+    for(int i=0; i<n; i++) {
+        int fd = evs[i].data.fd;
+        if (fd == m_timerfd) {
+            uint64_t expirations;
+            while (read(m_timerfd, &expirations, sizeof(expirations)) > 0) {
+            }
+            continue;
+        }
+        if (fd == m_wakefd[0]) {
+            runPosted();
+            continue;
+        }
+        auto hi = m_io.find(fd);
+        if (hi != m_io.end()) {
+            auto h = hi->second; // handler may remove itself
+            (*h)(fd, evs[i].events);
+        }
+    }
+#else
+    std::vector<struct pollfd> fds;
+    fds.push_back({ m_wakefd[0], POLLIN, 0 });
+    for(auto &io : m_io) {
+        fds.push_back({ io.first, POLLIN, 0 });
+    }
+    auto next = nextTimer();
+    if (next != clock::time_point::max()) {
+        auto dt = std::chrono::duration_cast<std::chrono::milliseconds>(next - clock::now()).count() + 1;
+        if (dt<0) dt=0;
+        if (msec<0 || dt<msec) msec=(int)dt;
+    }
+    int n = poll(fds.data(), fds.size(), msec);
+    if (n<0) {
+        return errno==EINTR;
+    }
+    if (fds[0].revents) {
+        runPosted();
+    }
+    for(auto &p : fds) {
+        if (p.revents && p.fd != m_wakefd[0]) {
+            auto hi = m_io.find(p.fd);
+            if (hi != m_io.end()) {
+                auto h = hi->second;
+                (*h)(p.fd, p.revents);
+            }
+        }
+    }
+#endif
+    fireTimers();
+    return true;
+}
+
+bool
+MdnsLoop::runOnce(int msec) {
+    return wait(msec);
+}
+
+bool
+MdnsLoop::runUntil(clock::time_point deadline) {
+    for(;;) {
+        auto now = clock::now();
+        if (now >= deadline) {
+            return true;
+        }
+        // round up so we never wake a hair early and spin
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+        if (!wait((int)left)) {
+            perror("MdnsLoop::wait");
+            return false;
+        }
+    }
+}
+
+/*
+ * Local Variables:
+ * mode: C++
+ * mode: font-lock
+ * c-basic-offset: 4
+ * tab-width: 8
+ * compile-command: "make.qmk"
+ * End:
+ */
+
+/* end of /github:elhernes/libmdns/mdns_loop.cpp */
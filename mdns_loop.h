@@ -0,0 +1,96 @@
+/********************************************************************************
+ * file: /github:elhernes/libmdns/mdns_loop.h
+ *
+ * born-on: Sun Oct 18 2026
+ * creator: Eric L. Hernes
+ *
+ * Event loop for mdns sockets and timers: epoll + timerfd on CLOCK_MONOTONIC
+ * (poll elsewhere), timers on a millisecond timer wheel.  One loop can service
+ * any number of MdnsRR instances; it is not thread safe, drive it from one
+ * thread at a time.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>    // for uint64_t
+#include <chrono>
+#include <functional>  // for function
+#include <map>
+#include <memory>      // for shared_ptr, unique_ptr
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "mdns_wheel.h"
+
+class MdnsLoop {
+ public:
+    using clock = std::chrono::steady_clock; // CLOCK_MONOTONIC
+    using IoHandler = std::function<void(int fd, unsigned events)>;
+    using TimerHandler = std::function<void()>;
+    using TimerId = uint64_t;
+
+    MdnsLoop();
+    virtual ~MdnsLoop();
+
+    static MdnsLoop &shared(); // process wide loop for instances that want to share one
+
+    // watch fd for input; events are EPOLLIN/EPOLLERR/EPOLLHUP (== POLLIN/POLLERR/POLLHUP)
+    bool add(int fd, IoHandler handler);
+    void remove(int fd);
+
+    TimerId addTimer(clock::time_point deadline, TimerHandler handler);
+    TimerId addTimer(std::chrono::milliseconds delay, TimerHandler handler) {
+        return addTimer(clock::now() + delay, handler);
+    }
+    bool cancelTimer(TimerId id);
+
+    // callable from any thread: run fn on the loop thread at its next wakeup, and force one
+    void post(TimerHandler fn);
+    void wakeup();
+
+    // the earliest timer deadline, to the wheel's millisecond; max() when there are none
+    clock::time_point nextTimer() const;
+
+    // dispatch events until deadline passes; false on a loop error
+    bool runUntil(clock::time_point deadline);
+    // wait at most msec (-1: until something happens) and dispatch once
+    bool runOnce(int msec);
+
+ protected:
+    struct Timer : MdnsTimerWheel::Node {
+        TimerId id;
+        TimerHandler handler;
+    };
+
+    uint64_t ticks(clock::time_point t, bool roundUp) const;
+    bool wait(int msec);
+    void fireTimers();
+    void armTimer();
+    void runPosted();
+
+ private:
+    int m_epfd;
+    int m_timerfd;
+    int m_wakefd[2];   // eventfd (both the same) or a pipe
+    std::mutex m_postMutex;
+    std::vector<TimerHandler> m_posted;
+    std::map<int, std::shared_ptr<IoHandler> > m_io;
+    clock::time_point m_epoch;  // wheel tick 0
+    MdnsTimerWheel m_wheel;     // 1ms ticks
+    std::unordered_map<TimerId, std::unique_ptr<Timer> > m_timers;
+    TimerId m_nextTimer;
+};
+
+/*
+ * Local Variables:
+ * mode: C++
+ * mode: font-lock
+ * c-basic-offset: 4
+ * tab-width: 8
+ * compile-command: "make.qmk"
+ * End:
+ */
+
+/* end of /github:elhernes/libmdns/mdns_loop.h */
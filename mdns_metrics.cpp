@@ -0,0 +1,90 @@
+/********************************************************************************
+ * file: /github:elhernes/libmdns/mdns_metrics.cpp
+ *
+ * born-on: Sun Oct 18 2026
+ * creator: Eric L. Hernes
+ *
+ * Prometheus text exposition of the metrics
+ *
+ */
+
+#include <stdio.h>   // for snprintf
+
+#include "mdns_metrics.h"
+
+void
+MdnsMetricsText::family(const char *name, const char *type, const char *help) {
+    m_out += "# HELP ";
+    m_out += name;
+    m_out += ' ';
+    m_out += help;
+    m_out += "\n# TYPE ";
+    m_out += name;
+    m_out += ' ';
+    m_out += type;
+    m_out += '\n';
+}
+
+void
+MdnsMetricsText::sample(const char *name, const std::string &labels, uint64_t value) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), " %llu\n", (unsigned long long)value);
+    m_out += name;
+    if (!labels.empty()) {
+        m_out += '{';
+        m_out += labels;
+        m_out += '}';
+    }
+    m_out += buf;
+}
+
+void
+MdnsMetricsText::histogram(const char *name, const char *help, const MdnsHistogram &h, double unit) {
+    family(name, "histogram", help);
+    std::string bucket = std::string(name) + "_bucket";
+    char le[64];
+    // read the buckets once: count is their sum, so the +Inf bucket agrees with them
+    uint64_t cumulative=0;
+    for(unsigned i=0; i<MdnsHistogram::kBuckets; i++) {
+        cumulative += h.bucket(i);
+        if (i+1 < MdnsHistogram::kBuckets) {
+            snprintf(le, sizeof(le), "le=\"%.9g\"", MdnsHistogram::bound(i)*unit);
+            sample(bucket.c_str(), le, cumulative);
+        }
+    }
+    sample(bucket.c_str(), "le=\"+Inf\"", cumulative);
+    char buf[64];
+    snprintf(buf, sizeof(buf), " %.9g\n", h.sum()*unit);
+    m_out += name;
+    m_out += "_sum";
+    m_out += buf;
+    sample((std::string(name) + "_count").c_str(), std::string(), cumulative);
+}
+
+std::string
+MdnsMetricsText::label(const char *name, const std::string &value) {
+    std::string s = name;
+    s += "=\"";
+    for(char c : value) {
+        switch (c) {
+        case '\\': s += "\\\\"; break;
+        case '"':  s += "\\\""; break;
+        case '\n': s += "\\n"; break;
+        default:   s += c;
+        }
+    }
+    s += '"';
+    return s;
+}
+
+/*
+ * Local Variables:
+ * mode: C++
+ * mode: font-lock
+ * c-basic-offset: 4
+ * tab-width: 8
+ * compile-command: "make.qmk"
+ * End:
+ */
+
+/* end of /github:elhernes/libmdns/mdns_metrics.cpp */
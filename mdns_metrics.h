@@ -0,0 +1,120 @@
+/********************************************************************************
+ * file: /github:elhernes/libmdns/mdns_metrics.h
+ *
+ * born-on: Sun Oct 18 2026
+ * creator: Eric L. Hernes
+ *
+ * Always-on instrumentation: counters and log2 histograms updated with relaxed
+ * atomic adds, safe to read from any thread, and a Prometheus text exposition
+ * writer for them.
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>    // for size_t
+#include <stdint.h>    // for uint64_t
+#include <atomic>
+#include <deque>
+#include <string>
+
+class MdnsCounter {
+ public:
+    MdnsCounter() : m_value(0) {}
+    MdnsCounter(const MdnsCounter &) = delete;
+    MdnsCounter &operator=(const MdnsCounter &) = delete;
+
+    void add(uint64_t n=1) { m_value.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t value() const { return m_value.load(std::memory_order_relaxed); }
+
+ private:
+    std::atomic<uint64_t> m_value;
+};
+
+// bucket i counts observations up to 2^(kFirstBit+i), as Prometheus' "le"; the last also
+// takes everything larger
+class MdnsHistogram {
+ public:
+    static const unsigned kFirstBit = 7;  // 128, e.g. ns
+    static const unsigned kBuckets = 24;  // up to 2^30, about a second in ns
+
+    MdnsHistogram() : m_count(0), m_sum(0) {
+        for(auto &b : m_buckets) b.store(0, std::memory_order_relaxed);
+    }
+    MdnsHistogram(const MdnsHistogram &) = delete;
+    MdnsHistogram &operator=(const MdnsHistogram &) = delete;
+
+    void observe(uint64_t v) {
+        unsigned b = v <= (1ull<<kFirstBit) ? 0 : 64 - __builtin_clzll(v-1) - kFirstBit;
+        if (b >= kBuckets) b = kBuckets-1;
+        m_buckets[b].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_sum.fetch_add(v, std::memory_order_relaxed);
+    }
+
+    static uint64_t bound(unsigned i) { return 1ull << (kFirstBit+i); }
+    uint64_t bucket(unsigned i) const { return m_buckets[i].load(std::memory_order_relaxed); }
+    uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+    uint64_t sum() const { return m_sum.load(std::memory_order_relaxed); }
+
+ private:
+    std::atomic<uint64_t> m_buckets[kBuckets];
+    std::atomic<uint64_t> m_count;
+    std::atomic<uint64_t> m_sum;
+};
+
+struct MdnsSocketMetrics {
+    MdnsSocketMetrics() : lastDrops(0) {}
+
+    MdnsCounter rxPackets;
+    MdnsCounter rxBytes;
+    MdnsCounter rxDrops;  // dropped by the kernel, receive buffer full (SO_RXQ_OVFL)
+    MdnsCounter txPackets;
+    MdnsCounter txBytes;  // the bursts built once and sent to every socket
+    uint32_t lastDrops;   // the kernel's count as last seen; receiving thread only
+};
+
+struct MdnsMetrics {
+    std::deque<MdnsSocketMetrics> sockets;  // per MdnsRR::interfaces() entry: IPv4, then IPv6
+    MdnsCounter rejected;         // not a response (flags check)
+    MdnsCounter truncated;
+    MdnsCounter malformed;
+    MdnsCounter records[3];       // by section: answer, authority, additional
+    MdnsHistogram callbackNs;     // per subscriber or record callback call
+    // from the kernel's arrival stamp: to the parser, per datagram (socket buffer and
+    // scheduling delay), and per question from its send to the first and last answer
+    // within MdnsRR::kAnswerWindowMs (network and responder)
+    MdnsHistogram rxDelayNs;
+    MdnsHistogram firstAnswerNs;
+    MdnsHistogram lastAnswerNs;
+};
+
+// Prometheus text exposition format, version 0.0.4
+class MdnsMetricsText {
+ public:
+    explicit MdnsMetricsText(std::string &out) : m_out(out) {}
+
+    // # HELP and # TYPE ("counter", "gauge", "histogram") ahead of a metric's samples
+    void family(const char *name, const char *type, const char *help);
+    // labels: empty, or 'interface="eth0",family="ipv4"'
+    void sample(const char *name, const std::string &labels, uint64_t value);
+    // the whole family, bucket bounds and sum scaled by unit (e.g. 1e-9 for ns to seconds)
+    void histogram(const char *name, const char *help, const MdnsHistogram &h, double unit);
+
+    static std::string label(const char *name, const std::string &value); // name="value", escaped
+
+ private:
+    std::string &m_out;
+};
+
+/*
+ * Local Variables:
+ * mode: C++
+ * mode: font-lock
+ * c-basic-offset: 4
+ * tab-width: 8
+ * compile-command: "make.qmk"
+ * End:
+ */
+
+/* end of /github:elhernes/libmdns/mdns_metrics.h */
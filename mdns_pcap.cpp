@@ -0,0 +1,438 @@
+/********************************************************************************
+ * file: /github:elhernes/libmdns/mdns_pcap.cpp
+ *
+ * born-on: Sun Oct 18 2026
+ * creator: Eric L. Hernes
+ *
+ * Minimal pcap/pcapng reader: yields the UDP port 5353 payloads of a capture
+ * with their source addresses, without libpcap
+ *
+ */
+
+#include <errno.h>
+#include <string.h>      // for memcpy, memset
+#include <sys/socket.h>  // for AF_INET, AF_INET6
+
+#include "mdns_pcap.h"
+
+namespace {
+    const uint32_t skPcapMagic = 0xa1b2c3d4;
+    const uint32_t skPcapNsecMagic = 0xa1b23c4d;
+    const uint32_t skPcapngShb = 0x0a0d0d0a;
+    const uint32_t skPcapngBom = 0x1a2b3c4d;
+
+    // pcapng block types
+    const uint32_t skIdb = 1;
+    const uint32_t skPb = 2;  // obsolete packet block
+    const uint32_t skSpb = 3;
+    const uint32_t skEpb = 6;
+
+    // link types we decode
+    const uint32_t skLinkNull = 0;
+    const uint32_t skLinkEthernet = 1;
+    const uint32_t skLinkRaw = 101;
+    const uint32_t skLinkLoop = 108;
+    const uint32_t skLinkSll = 113;
+    const uint32_t skLinkIpv4 = 228;
+    const uint32_t skLinkIpv6 = 229;
+    const uint32_t skLinkSll2 = 276;
+
+    const uint16_t skMdnsPort = 5353;
+
+    inline uint16_t
+    be16(const uint8_t *p) {
+        return (uint16_t)((p[0]<<8) | p[1]);
+    }
+
+    inline uint32_t
+    swap32(uint32_t v) {
+        return (v>>24) | ((v>>8)&0xff00) | ((v<<8)&0xff0000) | (v<<24);
+    }
+
+    // ns from a timestamp counted in units of 1/div seconds, without overflowing
+    inline uint64_t
+    toNs(uint64_t ts, uint64_t div) {
+        return (ts/div)*1000000000ULL + (ts%div)*1000000000ULL/div;
+    }
+}
+
+MdnsPcap::MdnsPcap() : m_fp(nullptr), m_ng(false), m_swap(false), m_nsec(false), m_linktype(0) {
+    m_stats = MdnsPcapStats();
+}
+
+MdnsPcap::~MdnsPcap() {
+    close();
+}
+
+bool
+MdnsPcap::open(const std::string &path) {
+    close();
+    m_stats = MdnsPcapStats();
+    m_error.clear();
+    m_fp = fopen(path.c_str(), "rb");
+    if (!m_fp) {
+        perror(path.c_str());
+        return false;
+    }
+
+    uint32_t magic;
+    if (fread(&magic, sizeof(magic), 1, m_fp)!=1) {
+        return fail("short file");
+    }
+    if (magic == skPcapngShb) {
+        // the section header block is read by nextPcapng(), which works out the byte order
+        m_ng = true;
+        rewind(m_fp);
+        return true;
+    }
+
+    m_ng = false;
+    if (magic == skPcapMagic || magic == skPcapNsecMagic) {
+        m_swap = false;
+    } else if (swap32(magic) == skPcapMagic || swap32(magic) == skPcapNsecMagic) {
+        m_swap = true;
+        magic = swap32(magic);
+    } else {
+        return fail("not a pcap or pcapng file");
+    }
+    m_nsec = (magic == skPcapNsecMagic);
+    if (!readBlock(20)) {
+        return fail("short pcap header");
+    }
+    m_linktype = get32(&m_buf[16]) & 0xffff; // upper bits carry FCS information
+    return true;
+}
+
+void
+MdnsPcap::close() {
+    if (m_fp) {
+        fclose(m_fp);
+        m_fp = nullptr;
+    }
+    m_ifs.clear();
+}
+
+bool
+MdnsPcap::fail(const char *msg) {
+    m_error = msg;
+    return false;
+}
+
+uint16_t
+MdnsPcap::get16(const uint8_t *p) const {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return m_swap ? (uint16_t)((v>>8) | (v<<8)) : v;
+}
+
+uint32_t
+MdnsPcap::get32(const uint8_t *p) const {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return m_swap ? swap32(v) : v;
+}
+
+bool
+MdnsPcap::readBlock(size_t n) {
+    if (m_buf.size() < n) {
+        m_buf.resize(n);
+    }
+    return n==0 || fread(m_buf.data(), 1, n, m_fp)==n;
+}
+
+bool
+MdnsPcap::next(MdnsPcapPacket &pkt) {
+    if (!m_fp) {
+        return false;
+    }
+    for(;;) {
+        bool have=false;
+        if (!(m_ng ? nextPcapng(pkt, have) : nextPcap(pkt, have))) {
+            return false;
+        }
+        if (have) {
+            m_stats.mdns++;
+            return true;
+        }
+    }
+}
+
+bool
+MdnsPcap::nextPcap(MdnsPcapPacket &pkt, bool &have) {
+    uint8_t hdr[16];
+    if (fread(hdr, 1, sizeof(hdr), m_fp)!=sizeof(hdr)) {
+        return false; // end of file
+    }
+    uint32_t caplen = get32(hdr+8);
+    if (caplen > 256*1024) {
+        return fail("corrupt pcap record length");
+    }
+    if (!readBlock(caplen)) {
+        return fail("truncated pcap record");
+    }
+    m_stats.frames++;
+    pkt.ns = (uint64_t)get32(hdr)*1000000000ULL + (uint64_t)get32(hdr+4)*(m_nsec ? 1 : 1000);
+    pkt.iface = 0;
+    have = decode(m_linktype, m_buf.data(), caplen, pkt);
+    return true;
+}
+
+bool
+MdnsPcap::nextPcapng(MdnsPcapPacket &pkt, bool &have) {
+    uint8_t hdr[8];
+    if (fread(hdr, 1, sizeof(hdr), m_fp)!=sizeof(hdr)) {
+        return false; // end of file
+    }
+    uint32_t type;
+    memcpy(&type, hdr, sizeof(type));
+    if (type == skPcapngShb) {
+        // a new section: byte order from its magic, interfaces start over
+        uint32_t bom;
+        if (fread(&bom, sizeof(bom), 1, m_fp)!=1) {
+            return fail("truncated section header");
+        }
+        if (bom == skPcapngBom) {
+            m_swap = false;
+        } else if (swap32(bom) == skPcapngBom) {
+            m_swap = true;
+        } else {
+            return fail("bad pcapng byte-order magic");
+        }
+        m_ifs.clear();
+        uint32_t total = get32(hdr+4);
+        if (total < 28 || (total&3) || total > 16*1024*1024) {
+            return fail("corrupt section header length");
+        }
+        return readBlock(total-12) ? true : fail("truncated section header");
+    }
+
+    type = get32(hdr);
+    uint32_t total = get32(hdr+4);
+    if (total < 12 || (total&3) || total > 16*1024*1024) {
+        return fail("corrupt pcapng block length");
+    }
+    size_t body = total-12;
+    if (!readBlock(body+4)) { // body and trailing length
+        return fail("truncated pcapng block");
+    }
+    const uint8_t *b = m_buf.data();
+
+    switch (type) {
+    case skIdb: {
+        if (body < 8) {
+            return fail("short interface block");
+        }
+        Interface ifc = { (uint32_t)get16(b), 1000000 };
+        // options: if_tsresol (9) changes the timestamp units
+        for(size_t o=8; o+4<=body; ) {
+            uint16_t code = get16(b+o), len = get16(b+o+2);
+            if (code==0 || o+4+len > body) {
+                break;
+            }
+            if (code==9 && len>=1) {
+                uint8_t r = b[o+4];
+                uint64_t div = 1;
+                for(unsigned i=0; i<(r&0x7f) && div < (1ULL<<60)/10; i++) {
+                    div *= (r&0x80) ? 2 : 10;
+                }
+                ifc.tsdiv = div;
+            }
+            o += 4 + ((len+3)&~3u);
+        }
+        m_ifs.push_back(ifc);
+        return true;
+    }
+
+    case skEpb:
+    case skPb: {
+        if (body < 20) {
+            return fail("short packet block");
+        }
+        uint32_t ifid = type==skEpb ? get32(b) : get16(b);
+        uint64_t ts = ((uint64_t)get32(b+4)<<32) | get32(b+8);
+        uint32_t caplen = get32(b+12);
+        if (caplen > body-20) {
+            return fail("corrupt packet block");
+        }
+        m_stats.frames++;
+        if (ifid >= m_ifs.size()) {
+            m_stats.linktype++;
+            return true;
+        }
+        pkt.ns = toNs(ts, m_ifs[ifid].tsdiv);
+        pkt.iface = ifid;
+        have = decode(m_ifs[ifid].linktype, b+20, caplen, pkt);
+        return true;
+    }
+
+    case skSpb: {
+        if (body < 4) {
+            return fail("short simple packet block");
+        }
+        uint32_t caplen = get32(b);
+        if (caplen > body-4) caplen = body-4;
+        m_stats.frames++;
+        if (m_ifs.empty()) {
+            m_stats.linktype++;
+            return true;
+        }
+        pkt.ns = 0; // no timestamp in a simple packet block
+        pkt.iface = 0;
+        have = decode(m_ifs[0].linktype, b+4, caplen, pkt);
+        return true;
+    }
+
+    default:
+        return true; // statistics, name resolution, custom blocks...
+    }
+}
+
+// strip the link layer down to the IP header
+bool
+MdnsPcap::decode(uint32_t linktype, const uint8_t *p, size_t len, MdnsPcapPacket &pkt) {
+    switch (linktype) {
+    case skLinkEthernet: {
+        if (len < 14) {
+            m_stats.other++;
+            return false;
+        }
+        uint16_t et = be16(p+12);
+        p += 14; len -= 14;
+        while ((et == 0x8100 || et == 0x88a8) && len >= 4) { // VLAN tags
+            et = be16(p+2);
+            p += 4; len -= 4;
+        }
+        if (et != 0x0800 && et != 0x86dd) {
+            m_stats.other++;
+            return false;
+        }
+        return decodeIp(p, len, pkt);
+    }
+
+    case skLinkNull:
+    case skLinkLoop: {
+        // address family, in the capturing host's order for NULL, network order for LOOP
+        if (len < 4) {
+            m_stats.other++;
+            return false;
+        }
+        uint32_t af = (p[0]==0 && p[1]==0) ? p[3] : p[0];
+        if (af != 2 && af != 24 && af != 28 && af != 30) { // AF_INET, BSD AF_INET6s
+            m_stats.other++;
+            return false;
+        }
+        return decodeIp(p+4, len-4, pkt);
+    }
+
+    case skLinkRaw:
+    case skLinkIpv4:
+    case skLinkIpv6:
+        return decodeIp(p, len, pkt);
+
+    case skLinkSll:
+        if (len < 16) {
+            m_stats.other++;
+            return false;
+        }
+        return decodeIp(p+16, len-16, pkt);
+
+    case skLinkSll2:
+        if (len < 20) {
+            m_stats.other++;
+            return false;
+        }
+        return decodeIp(p+20, len-20, pkt);
+
+    default:
+        m_stats.linktype++;
+        return false;
+    }
+}
+
+bool
+MdnsPcap::decodeIp(const uint8_t *p, size_t len, MdnsPcapPacket &pkt) {
+    memset(&pkt.from, 0, sizeof(pkt.from));
+    const uint8_t *udp;
+    size_t avail;
+    if (len >= 20 && (p[0]>>4) == 4) {
+        size_t ihl = (p[0]&0x0f)*4;
+        if (ihl < 20 || len < ihl || p[9] != 17) {
+            m_stats.other++;
+            return false;
+        }
+        if (be16(p+6) & 0x3fff) { // more fragments, or not the first
+            m_stats.fragments++;
+            return false;
+        }
+        size_t total = be16(p+2);
+        avail = (total >= ihl && total < len ? total : len) - ihl;
+        udp = p + ihl;
+        struct sockaddr_in *sin = (struct sockaddr_in*)&pkt.from;
+        sin->sin_family = AF_INET;
+        memcpy(&sin->sin_addr, p+12, 4);
+    } else if (len >= 40 && (p[0]>>4) == 6) {
+        uint8_t nh = p[6];
+        size_t total = 40 + be16(p+4);
+        size_t end = total < len ? total : len;  // the payload length, or less when captured short
+        size_t off = 40;
+        // hop-by-hop, routing and destination options headers
+        while ((nh == 0 || nh == 43 || nh == 60) && off+8 <= end) {
+            nh = p[off];
+            off += (p[off+1]+1)*8;
+        }
+        if (off > end || ((nh == 0 || nh == 43 || nh == 60) && off+8 > end)) {
+            m_stats.truncated++;
+            return false;
+        }
+        if (nh == 44) {
+            m_stats.fragments++;
+            return false;
+        }
+        if (nh != 17) {
+            m_stats.other++;
+            return false;
+        }
+        avail = end - off;
+        udp = p + off;
+        pkt.from.sin6_family = AF_INET6;
+        memcpy(&pkt.from.sin6_addr, p+8, 16);
+    } else {
+        m_stats.other++;
+        return false;
+    }
+
+    if (avail < 8) {
+        m_stats.truncated++;
+        return false;
+    }
+    uint16_t sport = be16(udp), dport = be16(udp+2);
+    size_t ulen = be16(udp+4);
+    if (sport != skMdnsPort && dport != skMdnsPort) {
+        m_stats.other++;
+        return false;
+    }
+    if (ulen < 8 || ulen > avail) {
+        m_stats.truncated++;
+        return false;
+    }
+    if (pkt.from.sin6_family == AF_INET) {
+        ((struct sockaddr_in*)&pkt.from)->sin_port = htons(sport);
+    } else {
+        pkt.from.sin6_port = htons(sport);
+    }
+    pkt.payload = udp+8;
+    pkt.length = ulen-8;
+    return true;
+}
+
+/*
+ * Local Variables:
+ * mode: C++
+ * mode: font-lock
+ * c-basic-offset: 4
+ * tab-width: 8
+ * compile-command: "make.rmk MK=tmdns.mk"
+ * End:
+ */
+
+/* end of /github:elhernes/libmdns/mdns_pcap.cpp */
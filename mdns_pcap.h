@@ -0,0 +1,90 @@
+/********************************************************************************
+ * file: /github:elhernes/libmdns/mdns_pcap.h
+ *
+ * born-on: Sun Oct 18 2026
+ * creator: Eric L. Hernes
+ *
+ * Minimal pcap/pcapng reader: yields the UDP port 5353 payloads of a capture
+ * with their source addresses, without libpcap
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>    // for size_t
+#include <stdint.h>    // for uint8_t, uint16_t, uint32_t, uint64_t
+#include <stdio.h>     // for FILE
+#include <netinet/in.h>
+#include <string>
+#include <vector>
+
+struct MdnsPcapPacket {
+    uint64_t ns;                 // capture time, ns since the epoch
+    struct sockaddr_in6 from;    // sockaddr_in for IPv4; port 5353 or a legacy client's port
+    const uint8_t *payload;      // valid until the next MdnsPcap::next()
+    size_t length;
+    uint32_t iface;              // pcapng interface id, 0 for pcap
+};
+
+struct MdnsPcapStats {
+    uint64_t frames;      // packet records read
+    uint64_t mdns;        // UDP 5353 payloads returned
+    uint64_t other;       // not IP/UDP/5353
+    uint64_t fragments;   // IPv4/IPv6 fragments, not reassembled
+    uint64_t truncated;   // snapped short of the UDP length
+    uint64_t linktype;    // on interfaces with a link type we do not decode
+};
+
+class MdnsPcap {
+ public:
+    MdnsPcap();
+    virtual ~MdnsPcap();
+
+    // pcap (either byte order, usec or nsec) or pcapng; false with errno/perror on failure
+    bool open(const std::string &path);
+    void close();
+
+    // next mDNS payload; false at end of file or on a corrupt capture (see error())
+    bool next(MdnsPcapPacket &pkt);
+
+    const MdnsPcapStats &stats() const { return m_stats; }
+    const std::string &error() const { return m_error; }
+
+ protected:
+    struct Interface {
+        uint32_t linktype;
+        uint64_t tsdiv;   // pcapng timestamp units per second
+    };
+
+    bool nextPcap(MdnsPcapPacket &pkt, bool &have);
+    bool nextPcapng(MdnsPcapPacket &pkt, bool &have);
+    bool readBlock(size_t n);
+    bool decode(uint32_t linktype, const uint8_t *p, size_t caplen, MdnsPcapPacket &pkt);
+    bool decodeIp(const uint8_t *p, size_t len, MdnsPcapPacket &pkt);
+    uint16_t get16(const uint8_t *p) const;
+    uint32_t get32(const uint8_t *p) const;
+    bool fail(const char *msg);
+
+ protected:
+    FILE *m_fp;
+    bool m_ng;
+    bool m_swap;       // file byte order differs from ours
+    bool m_nsec;       // pcap nanosecond timestamps
+    uint32_t m_linktype;
+    std::vector<Interface> m_ifs;
+    std::vector<uint8_t> m_buf;
+    MdnsPcapStats m_stats;
+    std::string m_error;
+};
+
+/*
+ * Local Variables:
+ * mode: C++
+ * mode: font-lock
+ * c-basic-offset: 4
+ * tab-width: 8
+ * compile-command: "make.rmk MK=tmdns.mk"
+ * End:
+ */
+
+/* end of /github:elhernes/libmdns/mdns_pcap.h */
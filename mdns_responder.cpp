@@ -0,0 +1,660 @@
+/********************************************************************************
+ * file: /github:elhernes/libmdns/mdns_responder.cpp
+ *
+ * born-on: Sun Oct 18 2026
+ * creator: Eric L. Hernes
+ *
+ * Authoritative mdns responder
+ *
+ */
+
+#include <stdint.h>  // for uint8_t, uint16_t, uint32_t
+#include <stddef.h>  // for size_t
+#include <string.h>  // for memcpy, memset
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netinet/in.h>
+
+#include "mdns_responder.h"
+#include "mdns_c.h"
+#include "mdns_loop.h"
+
+#include <algorithm>  // for find
+
+namespace {
+    const uint16_t skClassIn = 1;
+    const uint16_t skCacheFlush = 0x8000;
+    const uint16_t skQtypeAny = 255;
+    const uint32_t skLegacyTtl = 10;  // RFC 6762 section 6.7 cap for legacy unicast answers
+    const std::chrono::milliseconds skMulticastInterval(1000);  // RFC 6762 section 6, per record and link
+    const unsigned skSharedDelayMs[2] = { 20, 120 };  // RFC 6762 section 6, for shared records
+    const char skServices[] = "_services._dns-sd._udp.local";
+
+    std::string
+    nameKey(const std::string &name) {
+        char buf[256];
+        mdns_string_t k = mdns_string_key(name.c_str(), name.size(), buf, sizeof(buf));
+        return std::string(k.str, k.length);
+    }
+
+    std::string
+    nameRdata(const std::string &name) {
+        uint8_t buf[256];
+        uint8_t *end = mdns_string_make(buf, sizeof(buf), name.c_str(), name.size());
+        return end ? std::string((const char*)buf, end-buf) : std::string();
+    }
+
+    // key of the name at the start of uncompressed rdata
+    std::string
+    rdataTarget(const std::string &rdata, size_t offset) {
+        char buf[256];
+        mdns_string_t ms = mdns_string_extract((const uint8_t*)rdata.data(), rdata.size(), &offset,
+                                               buf, sizeof(buf));
+        char kbuf[256];
+        mdns_string_t k = mdns_string_key(ms.str, ms.length, kbuf, sizeof(kbuf));
+        return std::string(k.str, k.length);
+    }
+
+    struct sockaddr_in
+    group4() {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+#ifdef __APPLE__
+        addr.sin_len = sizeof(addr);
+#endif
+        addr.sin_addr.s_addr = htonl((((uint32_t)224U) << 24U) | ((uint32_t)251U));
+        addr.sin_port = htons(5353);
+        return addr;
+    }
+
+    struct sockaddr_in6
+    group6() {
+        struct sockaddr_in6 addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin6_family = AF_INET6;
+#ifdef __APPLE__
+        addr.sin6_len = sizeof(addr);
+#endif
+        addr.sin6_addr.s6_addr[0] = 0xFF;
+        addr.sin6_addr.s6_addr[1] = 0x02;
+        addr.sin6_addr.s6_addr[15] = 0xFB;
+        addr.sin6_port = htons(5353);
+        return addr;
+    }
+
+    const struct sockaddr_in skGroup4 = group4();
+    const struct sockaddr_in6 skGroup6 = group6();
+}
+
+MdnsResponder::MdnsResponder(const std::vector<std::string> &netifs, MdnsLoop *loop)
+    : m_nquestions(0), m_nknown(0), m_timer(0), m_rand((unsigned)clock::now().time_since_epoch().count()),
+      m_rxring(new mdns_rxring_t), m_loop(loop), m_ownLoop(loop ? nullptr : new MdnsLoop), m_stats() {
+    if (!m_loop) {
+        m_loop = m_ownLoop.get();
+    }
+    if (mdns_rxring_init(m_rxring, MDNS_RX_BATCH, 2048)) {
+        perror("mdns_rxring_init");
+    }
+
+    std::vector<unsigned> ifv;
+    for(auto &n : netifs.size()>0 ? netifs : MdnsRR::systemInterfaces()) {
+        unsigned ifindex = if_nametoindex(n.c_str());
+        if (ifindex==0) {
+            perror(n.c_str());
+        } else {
+            ifv.push_back(ifindex);
+        }
+    }
+    if (ifv.empty()) {
+        ifv.push_back(0);
+    }
+    for(unsigned ifindex : ifv) {
+        for(int fd : { mdns_socket_open_ipv4_service(ifindex), mdns_socket_open_ipv6_service(ifindex) }) {
+            if (fd>=0) {
+                size_t sock = m_socks.size();
+                m_socks.push_back({ fd, ifindex });
+                m_loop->add(fd, [this, sock](int, unsigned) { onReadable(sock); });
+            }
+        }
+    }
+    if (m_socks.empty()) {
+        perror("MdnsResponder: no sockets on port 5353");
+    }
+}
+
+MdnsResponder::~MdnsResponder() {
+    if (m_timer) {
+        m_loop->cancelTimer(m_timer);
+    }
+    for(auto &s : m_socks) {
+        m_loop->remove(s.fd);
+        mdns_socket_close(s.fd);
+    }
+    mdns_rxring_free(m_rxring);
+    delete m_rxring;
+}
+
+void
+MdnsResponder::addRecord(const std::string &name, mdns_recordtype type, uint16_t rclass, uint32_t ttl,
+                         const std::string &rdata) {
+    for(auto &r : m_records) {
+        if (r.type==type && r.rdata==rdata && r.key==nameKey(name)) {
+            return;
+        }
+    }
+    m_records.push_back({ name, nameKey(name), (uint16_t)type, rclass, ttl, rdata });
+}
+
+bool
+MdnsResponder::addHost(const std::string &host, const std::vector<std::string> &addrs) {
+    bool rv=false;
+    for(auto &a : addrs.size()>0 ? addrs : localAddresses()) {
+        struct in_addr a4;
+        struct in6_addr a6;
+        if (inet_pton(AF_INET, a.c_str(), &a4)==1) {
+            addRecord(host, mdns_recordtype::A, skCacheFlush|skClassIn, kHostTtl,
+                      std::string((const char*)&a4, sizeof(a4)));
+            rv=true;
+        } else if (inet_pton(AF_INET6, a.c_str(), &a6)==1) {
+            addRecord(host, mdns_recordtype::AAAA, skCacheFlush|skClassIn, kHostTtl,
+                      std::string((const char*)&a6, sizeof(a6)));
+            rv=true;
+        }
+    }
+    return rv;
+}
+
+void
+MdnsResponder::addService(const std::string &instance, const std::string &type, const std::string &host,
+                          uint16_t port, const std::vector<std::string> &txt) {
+    std::string fqin = instance + "." + type;
+
+    addRecord(skServices, mdns_recordtype::PTR, skClassIn, kOtherTtl, nameRdata(type));
+    addRecord(type, mdns_recordtype::PTR, skClassIn, kOtherTtl, nameRdata(fqin));
+
+    // RFC 2782: priority, weight, port, target
+    uint8_t srv[6] = { 0, 0, 0, 0, (uint8_t)(port>>8), (uint8_t)port };
+    addRecord(fqin, mdns_recordtype::SRV, skCacheFlush|skClassIn, kHostTtl,
+              std::string((const char*)srv, sizeof(srv)) + nameRdata(host));
+
+    // RFC 6763 section 6.1: one length-prefixed string per pair, a single empty one if none
+    std::string tr;
+    for(auto &t : txt) {
+        size_t n = t.size()<255 ? t.size() : 255;
+        tr += (char)n;
+        tr.append(t, 0, n);
+    }
+    if (tr.empty()) {
+        tr += '\0';
+    }
+    addRecord(fqin, mdns_recordtype::TXT, skCacheFlush|skClassIn, kOtherTtl, tr);
+}
+
+void
+MdnsResponder::clear() {
+    m_records.clear();
+    m_delayed.clear();
+    m_packets.clear();
+}
+
+// RFC 6763 section 12 additional records
+void
+MdnsResponder::addAdditional(std::vector<const Record*> &v, const std::string &key, uint16_t type) const {
+    for(auto &r : m_records) {
+        if (r.key==key && r.type==type && std::find(v.begin(), v.end(), &r)==v.end()) {
+            v.push_back(&r);
+        }
+    }
+}
+
+// the answers to (key, qtype) and their additional records, added to what an and ar hold
+void
+MdnsResponder::answerSet(std::string_view key, uint16_t qtype, std::vector<const Record*> &an,
+                         std::vector<const Record*> &ar) const {
+    size_t n0 = an.size();
+    for(auto &r : m_records) {
+        if (r.key==key && (r.type==qtype || qtype==skQtypeAny) && std::find(an.begin(), an.end(), &r)==an.end()) {
+            an.push_back(&r);
+        }
+    }
+    for(size_t i=n0; i<an.size(); i++) {
+        const Record *a = an[i];
+        switch (a->type) {
+        case mdns_recordtype::PTR: {
+            std::string target = rdataTarget(a->rdata, 0);
+            addAdditional(ar, target, mdns_recordtype::SRV);
+            addAdditional(ar, target, mdns_recordtype::TXT);
+            for(auto &r : m_records) {
+                if (r.key==target && r.type==mdns_recordtype::SRV) {
+                    std::string host = rdataTarget(r.rdata, 6);
+                    addAdditional(ar, host, mdns_recordtype::A);
+                    addAdditional(ar, host, mdns_recordtype::AAAA);
+                }
+            }
+        }
+            break;
+        case mdns_recordtype::SRV: {
+            std::string host = rdataTarget(a->rdata, 6);
+            addAdditional(ar, host, mdns_recordtype::A);
+            addAdditional(ar, host, mdns_recordtype::AAAA);
+        }
+            break;
+        case mdns_recordtype::A:
+            addAdditional(ar, a->key, mdns_recordtype::AAAA);
+            break;
+        case mdns_recordtype::AAAA:
+            addAdditional(ar, a->key, mdns_recordtype::A);
+            break;
+        default:
+            break;
+        }
+    }
+    ar.erase(std::remove_if(ar.begin(), ar.end(), [&](const Record *r) {
+                return std::find(an.begin(), an.end(), r)!=an.end();
+            }), ar.end());
+}
+
+// answers, then additional records, as many as fit; legacy unicast (RFC 6762 section 6.7)
+// without the cache-flush bit and with TTLs capped
+void
+MdnsResponder::writeRecords(mdns_writer_t &writer, const std::vector<const Record*> &an,
+                            const std::vector<const Record*> &ar, bool legacy) const {
+    const std::vector<const Record*> *sections[2] = { &an, &ar };
+    const mdns_entrytype kinds[2] = { mdns_entrytype::ANSWER, mdns_entrytype::ADDITIONAL };
+    for(unsigned s=0; s<2; s++) {
+        for(auto r : *sections[s]) {
+            mdns_record_t rec = { r->name.c_str(), r->name.size(), r->type, r->rclass, r->ttl,
+                                  (const uint8_t*)r->rdata.data(), r->rdata.size() };
+            if (legacy) {
+                rec.rclass &= ~skCacheFlush;
+                if (rec.ttl > skLegacyTtl) rec.ttl = skLegacyTtl;
+            }
+            if (mdns_writer_record(&writer, kinds[s], &rec)) {
+                break; // what fits
+            }
+        }
+    }
+}
+
+MdnsResponder::Compiled
+MdnsResponder::compileResponse(const std::string &key, uint16_t qtype) const {
+    Compiled c;
+    std::vector<const Record*> an, ar;
+    answerSet(key, qtype, an, ar);
+    if (an.empty()) {
+        return c;
+    }
+    c.shared = false;
+    for(auto r : an) {
+        c.answers.push_back((size_t)(r - m_records.data()));
+        c.shared |= (r->rclass & skCacheFlush) == 0;
+    }
+    c.multicast.assign(m_socks.size(), clock::time_point::min());
+
+    uint8_t buffer[MDNS_PACKET_MTU];
+    mdns_writer_t writer;
+    mdns_writer_init(&writer, buffer, sizeof(buffer), 0, 0x8400); // response, authoritative
+    writeRecords(writer, an, ar, false);
+    size_t length = mdns_writer_finish(&writer);
+    c.packet.assign((const char*)buffer, length);
+    return c;
+}
+
+// the response to (key, qtype) without the records the querier listed as known answers;
+// empty when that leaves no answers
+std::string
+MdnsResponder::trimmedResponse(std::string_view key, uint16_t qtype) const {
+    std::vector<const Record*> an, ar;
+    answerSet(key, qtype, an, ar);
+    auto isKnown = [this](const Record *r) { return known(*r); };
+    an.erase(std::remove_if(an.begin(), an.end(), isKnown), an.end());
+    ar.erase(std::remove_if(ar.begin(), ar.end(), isKnown), ar.end());
+    if (an.empty()) {
+        return std::string();
+    }
+    uint8_t buffer[MDNS_PACKET_MTU];
+    mdns_writer_t writer;
+    mdns_writer_init(&writer, buffer, sizeof(buffer), 0, 0x8400);
+    writeRecords(writer, an, ar, false);
+    size_t length = mdns_writer_finish(&writer);
+    return std::string((const char*)buffer, length);
+}
+
+void
+MdnsResponder::compile() {
+    m_delayed.clear();
+    m_packets.clear();
+    for(auto &r : m_records) {
+        for(uint16_t qtype : { r.type, skQtypeAny }) {
+            auto &pm = m_packets[qtype];
+            if (pm.find(r.key)==pm.end()) {
+                pm[r.key] = compileResponse(r.key, qtype);
+            }
+        }
+    }
+}
+
+size_t
+MdnsResponder::packets() const {
+    size_t n=0;
+    for(auto &pm : m_packets) {
+        n += pm.second.size();
+    }
+    return n;
+}
+
+MdnsResponder::Compiled *
+MdnsResponder::response(std::string_view name, uint16_t qtype) {
+    auto pi = m_packets.find(qtype);
+    if (pi == m_packets.end()) {
+        return nullptr;
+    }
+    char buf[256];
+    mdns_string_t k = mdns_string_key(name.data(), name.size(), buf, sizeof(buf));
+    auto ri = pi->second.find(std::string_view(k.str, k.length));
+    return ri == pi->second.end() || ri->second.answers.empty() ? nullptr : &ri->second;
+}
+
+bool
+MdnsResponder::run(int msec) {
+    return m_loop->runUntil(MdnsLoop::clock::now() + std::chrono::milliseconds(msec));
+}
+
+void
+MdnsResponder::onReadable(size_t sock) {
+    size_t n = mdns_recv_batch(m_socks[sock].fd, m_rxring);
+    for(size_t p=0; p<n; p++) {
+        onQuery(sock, (const struct sockaddr*)&m_rxring->addrs[p],
+                m_rxring->buffers + p*m_rxring->capacity, m_rxring->lengths[p]);
+    }
+}
+
+// the questions, and the known answers that follow them, into m_questions and m_known;
+// false when the questions run past the end (a short known-answer list is kept)
+bool
+MdnsResponder::parseQuery(const uint8_t *buffer, size_t size) {
+    uint16_t questions = (uint16_t)((buffer[4]<<8) | buffer[5]);
+    uint16_t answers = (uint16_t)((buffer[6]<<8) | buffer[7]);
+    m_nquestions = 0;
+    m_nknown = 0;
+    size_t offset = 12;
+    for(uint16_t q=0; q<questions; q++) {
+        char namebuf[256];
+        mdns_string_t name = mdns_string_extract(buffer, size, &offset, namebuf, sizeof(namebuf));
+        if (offset+4 > size) {
+            return false;
+        }
+        if (m_nquestions == m_questions.size()) m_questions.emplace_back();
+        Question &qq = m_questions[m_nquestions++];
+        qq.name.assign(name.str, name.length);
+        qq.qtype = (uint16_t)((buffer[offset]<<8) | buffer[offset+1]);
+        qq.qclass = (uint16_t)((buffer[offset+2]<<8) | buffer[offset+3]);
+        offset += 4;
+    }
+    for(uint16_t a=0; a<answers; a++) {
+        char namebuf[256];
+        mdns_string_t name = mdns_string_extract(buffer, size, &offset, namebuf, sizeof(namebuf));
+        if (offset+10 > size) {
+            break;
+        }
+        const uint8_t *p = buffer + offset;
+        size_t rdlen = (size_t)((p[8]<<8) | p[9]);
+        offset += 10;
+        if (offset+rdlen > size) {
+            break;
+        }
+        uint16_t type = (uint16_t)((p[0]<<8) | p[1]);
+        uint8_t rdata[512];
+        size_t n = mdns_record_rdata_expand(buffer, size, offset, rdlen, type, rdata, sizeof(rdata));
+        offset += rdlen;
+        if (n==0 && rdlen>0) {
+            continue;
+        }
+        if (m_nknown == m_known.size()) m_known.emplace_back();
+        KnownAnswer &k = m_known[m_nknown++];
+        char kbuf[256];
+        mdns_string_t key = mdns_string_key(name.str, name.length, kbuf, sizeof(kbuf));
+        k.key.assign(key.str, key.length);
+        k.type = type;
+        k.ttl = (uint32_t)p[4]<<24 | (uint32_t)p[5]<<16 | (uint32_t)p[6]<<8 | p[7];
+        k.rdata.assign((const char*)rdata, n);
+    }
+    return true;
+}
+
+// RFC 6762 section 7.1: the querier listed r with at least half its TTL left
+bool
+MdnsResponder::known(const Record &r) const {
+    for(size_t i=0; i<m_nknown; i++) {
+        const KnownAnswer &k = m_known[i];
+        if (k.type==r.type && 2*(uint64_t)k.ttl >= r.ttl && k.key==r.key && k.rdata==r.rdata) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void
+MdnsResponder::onQuery(size_t sock, const struct sockaddr *from, const uint8_t *buffer, size_t size) {
+    int fd = m_socks[sock].fd;
+    if (size<12) {
+        return;
+    }
+    uint16_t flags = (uint16_t)((buffer[2]<<8) | buffer[3]);
+    if ((flags & 0xF800)!=0) {
+        return; // a response, or not a standard query
+    }
+    m_stats.queries++;
+    if (!parseQuery(buffer, size)) {
+        return;
+    }
+    m_stats.questions += m_nquestions;
+
+    bool v6 = from->sa_family == AF_INET6;
+    uint16_t sport = v6 ? ntohs(((const struct sockaddr_in6*)from)->sin6_port)
+        : ntohs(((const struct sockaddr_in*)from)->sin_port);
+    socklen_t fromlen = v6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+    if (sport != 5353) {
+        onLegacyQuery(fd, from, fromlen, buffer);
+        return;
+    }
+
+    std::string trimmed;
+    for(size_t q=0; q<m_nquestions; q++) {
+        const Question &qq = m_questions[q];
+        Compiled *c = response(qq.name, qq.qtype);
+        if (!c) {
+            m_stats.unknown++;
+            continue;
+        }
+        const std::string *pkt = &c->packet;
+        if (m_nknown) {
+            size_t nknown=0;
+            for(size_t ri : c->answers) {
+                if (known(m_records[ri])) nknown++;
+            }
+            if (nknown == c->answers.size()) {
+                m_stats.suppressed++;
+                continue;
+            }
+            if (nknown) {
+                char kbuf[256];
+                mdns_string_t k = mdns_string_key(qq.name.data(), qq.name.size(), kbuf, sizeof(kbuf));
+                trimmed = trimmedResponse(std::string_view(k.str, k.length), qq.qtype);
+                pkt = &trimmed;
+            }
+        }
+
+        if (qq.qclass & 0x8000) {
+            // QU question
+            if (sendto(fd, pkt->data(), pkt->size(), 0, from, fromlen) > 0) {
+                m_stats.answered++;
+            }
+        } else if (c->shared) {
+            delay(*c, sock, from, pkt==&trimmed ? trimmed : std::string());
+        } else {
+            sendMulticast(*c, sock, *pkt, from, clock::now());
+        }
+    }
+}
+
+// hold a shared answer back a random 20-120ms so that several responders' answers, and
+// repeats of the question, go out as one; a repeat wants everything unless both trimmed alike
+void
+MdnsResponder::delay(Compiled &c, size_t sock, const struct sockaddr *from, const std::string &trimmed) {
+    auto di = m_delayed.find(std::make_pair(&c, sock));
+    if (di != m_delayed.end()) {
+        m_stats.aggregated++;
+        if (di->second.trimmed != trimmed) {
+            di->second.trimmed.clear();
+        }
+        return;
+    }
+    Delayed &d = m_delayed[std::make_pair(&c, sock)];
+    d.at = clock::now() + std::chrono::milliseconds(skSharedDelayMs[0] +
+                                                    m_rand()%(skSharedDelayMs[1]-skSharedDelayMs[0]+1));
+    d.trimmed = trimmed;
+    memcpy(&d.from, from, from->sa_family==AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+    arm();
+}
+
+// multicast packet, c's or a trimmed copy, on sock; unicast to the querier instead if c
+// already went out there within the last second
+void
+MdnsResponder::sendMulticast(Compiled &c, size_t sock, const std::string &packet, const struct sockaddr *from,
+                             clock::time_point now) {
+    int fd = m_socks[sock].fd;
+    bool v6 = from->sa_family == AF_INET6;
+    clock::time_point &last = c.multicast[sock];
+    ssize_t sent;
+    if (now < last + skMulticastInterval) {
+        m_stats.throttled++;
+        sent = sendto(fd, packet.data(), packet.size(), 0, from,
+                      v6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+    } else {
+        last = now;
+        if (v6) {
+            sent = sendto(fd, packet.data(), packet.size(), 0, (const struct sockaddr*)&skGroup6, sizeof(skGroup6));
+        } else {
+            sent = sendto(fd, packet.data(), packet.size(), 0, (const struct sockaddr*)&skGroup4, sizeof(skGroup4));
+        }
+    }
+    if (sent>0) {
+        m_stats.answered++;
+    }
+}
+
+// keep the one loop timer on the earliest delayed answer
+void
+MdnsResponder::arm() {
+    clock::time_point next = clock::time_point::max();
+    for(auto &d : m_delayed) {
+        if (d.second.at < next) next = d.second.at;
+    }
+    if (m_timer && m_timerAt == next) {
+        return;
+    }
+    if (m_timer) {
+        m_loop->cancelTimer(m_timer);
+        m_timer = 0;
+    }
+    if (next != clock::time_point::max()) {
+        m_timerAt = next;
+        m_timer = m_loop->addTimer(next, [this]() {
+                m_timer = 0;
+                tick();
+            });
+    }
+}
+
+// send the delayed answers that are due
+void
+MdnsResponder::tick() {
+    clock::time_point now = clock::now();
+    for(auto di = m_delayed.begin(); di != m_delayed.end(); ) {
+        if (di->second.at > now) {
+            ++di;
+            continue;
+        }
+        Compiled &c = *di->first.first;
+        const Delayed &d = di->second;
+        sendMulticast(c, di->first.second, d.trimmed.empty() ? c.packet : d.trimmed,
+                      (const struct sockaddr*)&d.from, now);
+        di = m_delayed.erase(di);
+    }
+    arm();
+}
+
+// RFC 6762 section 6.7 legacy unicast, a query from a port other than 5353 (e.g. a stub
+// resolver): one reply with the query id and questions echoed and every answer, unique
+// records without the cache-flush bit and TTLs capped, built here since the compiled
+// packets have none of that
+void
+MdnsResponder::onLegacyQuery(int fd, const struct sockaddr *from, socklen_t fromlen, const uint8_t *buffer) {
+    uint8_t reply[MDNS_PACKET_MTU];
+    mdns_writer_t writer;
+    mdns_writer_init(&writer, reply, sizeof(reply), (uint16_t)((buffer[0]<<8) | buffer[1]), 0x8400);
+    std::vector<const Record*> an, ar;
+    for(size_t q=0; q<m_nquestions; q++) {
+        const Question &qq = m_questions[q];
+        if (mdns_writer_question(&writer, qq.name.data(), qq.name.size(), qq.qtype, qq.qclass)) {
+            return;
+        }
+        char kbuf[256];
+        mdns_string_t k = mdns_string_key(qq.name.data(), qq.name.size(), kbuf, sizeof(kbuf));
+        size_t n0 = an.size();
+        answerSet(std::string_view(k.str, k.length), qq.qtype, an, ar);
+        if (an.size() == n0) {
+            m_stats.unknown++;
+        }
+    }
+    if (an.empty()) {
+        return;
+    }
+    writeRecords(writer, an, ar, true);
+    size_t length = mdns_writer_finish(&writer);
+    if (sendto(fd, reply, length, 0, from, fromlen) > 0) {
+        m_stats.answered++;
+    }
+}
+
+std::vector<std::string>
+MdnsResponder::localAddresses() {
+    std::vector<std::string> v;
+    struct ifaddrs *ifa0;
+    if (getifaddrs(&ifa0)==0) {
+        for(struct ifaddrs *ifa=ifa0; ifa; ifa=ifa->ifa_next) {
+            if (!ifa->ifa_addr || !(ifa->ifa_flags & IFF_UP) || (ifa->ifa_flags & IFF_LOOPBACK)) {
+                continue;
+            }
+            char buf[INET6_ADDRSTRLEN];
+            if (ifa->ifa_addr->sa_family == AF_INET) {
+                inet_ntop(AF_INET, &((struct sockaddr_in*)ifa->ifa_addr)->sin_addr, buf, sizeof(buf));
+                v.push_back(buf);
+            } else if (ifa->ifa_addr->sa_family == AF_INET6) {
+                inet_ntop(AF_INET6, &((struct sockaddr_in6*)ifa->ifa_addr)->sin6_addr, buf, sizeof(buf));
+                v.push_back(buf);
+            }
+        }
+        freeifaddrs(ifa0);
+    }
+    return v;
+}
+
+/*
+ * Local Variables:
+ * mode: C++
+ * mode: font-lock
+ * c-basic-offset: 4
+ * tab-width: 8
+ * compile-command: "make.qmk"
+ * End:
+ */
+
+/* end of /github:elhernes/libmdns/mdns_responder.cpp */
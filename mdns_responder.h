@@ -0,0 +1,159 @@
+/********************************************************************************
+ * file: /github:elhernes/libmdns/mdns_responder.h
+ *
+ * born-on: Sun Oct 18 2026
+ * creator: Eric L. Hernes
+ *
+ * Authoritative mdns responder: answers queries for a registered record set
+ * from response packets compiled ahead of time, one per (name, qtype)
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>    // for size_t
+#include <stdint.h>    // for uint16_t, uint32_t, uint64_t
+#include <chrono>
+#include <map>
+#include <memory>      // for unique_ptr
+#include <random>
+#include <string>
+#include <string_view>
+#include <utility>     // for pair
+#include <vector>
+
+#include "mdns.h"
+#include "mdns_loop.h"
+
+struct MdnsResponderStats {
+    uint64_t queries;    // query packets received
+    uint64_t questions;  // questions in them
+    uint64_t answered;   // response packets sent
+    uint64_t unknown;    // questions for names/types we do not own
+    uint64_t suppressed; // questions whose every answer the querier already had (known answers)
+    uint64_t throttled;  // answers sent unicast, multicast on that interface less than a second ago
+    uint64_t aggregated; // questions folded into a shared answer already waiting to go out
+};
+
+class MdnsResponder {
+ public:
+    // RFC 6762 section 10 recommendations
+    static const uint32_t kHostTtl = 120;
+    static const uint32_t kOtherTtl = 75*60;
+
+    // netifs as for MdnsRR; loop: nullptr for a private one
+    MdnsResponder(const std::vector<std::string> &netifs=std::vector<std::string>(), MdnsLoop *loop=nullptr);
+    virtual ~MdnsResponder();
+
+    // rdata in wire form with names uncompressed; set the cache-flush bit in rclass for unique records
+    void addRecord(const std::string &name, mdns_recordtype type, uint16_t rclass, uint32_t ttl,
+                   const std::string &rdata);
+    // A/AAAA for host (e.g. "box.local") from numeric addresses; none: the interfaces' addresses
+    bool addHost(const std::string &host, const std::vector<std::string> &addrs=std::vector<std::string>());
+    // instance "My Box", type "_ssh._tcp.local", txt "key=value"
+    void addService(const std::string &instance, const std::string &type, const std::string &host,
+                    uint16_t port, const std::vector<std::string> &txt=std::vector<std::string>());
+    void clear();
+
+    // rebuild the response packets after adding records
+    void compile();
+
+    // answer queries for up to msec
+    bool run(int msec);
+
+    MdnsLoop &loop() { return *m_loop; }
+    const MdnsResponderStats &stats() const { return m_stats; }
+    size_t packets() const;
+
+    static std::vector<std::string> localAddresses();
+
+ protected:
+    using clock = MdnsLoop::clock;
+
+    struct Record {
+        std::string name;     // as given
+        std::string key;      // lowercase, no trailing dot
+        uint16_t type;
+        uint16_t rclass;  // with the cache-flush bit
+        uint32_t ttl;
+        std::string rdata;
+    };
+    struct Socket {
+        int fd;
+        unsigned ifindex;
+    };
+    // the response to one (name, qtype), built by compile()
+    struct Compiled {
+        std::string packet;
+        std::vector<size_t> answers;  // m_records indices in its answer section
+        std::vector<clock::time_point> multicast;  // last multicast on each m_socks entry
+        bool shared;  // an answer without the cache-flush bit, multicast after a random delay
+    };
+    // a shared answer waiting out its RFC 6762 section 6 delay, by (response, m_socks index)
+    struct Delayed {
+        clock::time_point at;
+        std::string trimmed;           // without known answers, empty: the compiled packet
+        struct sockaddr_storage from;  // the first querier, for a throttled answer
+    };
+    // one query being answered, parsed by parseQuery() into reused storage
+    struct Question {
+        std::string name;
+        uint16_t qtype;
+        uint16_t qclass;
+    };
+    struct KnownAnswer {
+        std::string key;     // nameKey() form
+        uint16_t type;
+        uint32_t ttl;
+        std::string rdata;   // names uncompressed, as Record::rdata
+    };
+
+    void onReadable(size_t sock);
+    void onQuery(size_t sock, const struct sockaddr *from, const uint8_t *buffer, size_t size);
+    void onLegacyQuery(int fd, const struct sockaddr *from, socklen_t fromlen, const uint8_t *buffer);
+    bool parseQuery(const uint8_t *buffer, size_t size);
+    bool known(const Record &r) const;
+    Compiled *response(std::string_view name, uint16_t qtype);
+    Compiled compileResponse(const std::string &key, uint16_t qtype) const;
+    std::string trimmedResponse(std::string_view key, uint16_t qtype) const;
+    void answerSet(std::string_view key, uint16_t qtype, std::vector<const Record*> &an,
+                   std::vector<const Record*> &ar) const;
+    void delay(Compiled &c, size_t sock, const struct sockaddr *from, const std::string &trimmed);
+    void sendMulticast(Compiled &c, size_t sock, const std::string &packet, const struct sockaddr *from,
+                       clock::time_point now);
+    void arm();
+    void tick();
+    void writeRecords(struct mdns_writer_t &writer, const std::vector<const Record*> &an,
+                      const std::vector<const Record*> &ar, bool legacy) const;
+    void addAdditional(std::vector<const Record*> &v, const std::string &key, uint16_t type) const;
+
+ protected:
+    std::vector<Record> m_records;
+    std::vector<Socket> m_socks;
+    // qtype -> name key -> response
+    std::map<uint16_t, std::map<std::string, Compiled, std::less<> > > m_packets;
+    std::vector<Question> m_questions;  // of the query being answered, m_nquestions used
+    size_t m_nquestions;
+    std::vector<KnownAnswer> m_known;   // its known answers, m_nknown used
+    size_t m_nknown;
+    std::map<std::pair<Compiled*, size_t>, Delayed> m_delayed;
+    MdnsLoop::TimerId m_timer;  // on the earliest m_delayed, 0 for none
+    clock::time_point m_timerAt;
+    std::minstd_rand m_rand;
+    struct mdns_rxring_t *m_rxring;
+    MdnsLoop *m_loop;
+    std::unique_ptr<MdnsLoop> m_ownLoop;
+    MdnsResponderStats m_stats;
+};
+
+/*
+ * Local Variables:
+ * mode: C++
+ * mode: font-lock
+ * c-basic-offset: 4
+ * tab-width: 8
+ * compile-command: "make.qmk"
+ * End:
+ */
+
+/* end of /github:elhernes/libmdns/mdns_responder.h */
@@ -0,0 +1,229 @@
+/********************************************************************************
+ * file: /github:elhernes/libmdns/mdns_scheduler.cpp
+ *
+ * born-on: Sun Oct 18 2026
+ * creator: Eric L. Hernes
+ *
+ * RFC 6762 section 5.2 continuous queries: exponential backoff plus cache
+ * refresh at 80/85/90/95% of TTL, all questions driven by one loop timer
+ *
+ */
+
+#include "mdns_scheduler.h"
+#include "mdns_c.h"      // for mdns_string_key
+#include "mdns_cache.h"
+
+constexpr std::chrono::milliseconds MdnsScheduler::kAggregate;
+constexpr std::chrono::seconds MdnsScheduler::kFirstInterval;
+constexpr std::chrono::seconds MdnsScheduler::kMaxInterval;
+const size_t MdnsScheduler::kKeyMax;
+
+namespace {
+    // section 5.2: refresh at these percentages of the record's TTL
+    const unsigned skRefreshPercent[] = { 80, 85, 90, 95 };
+}
+
+MdnsScheduler::MdnsScheduler(MdnsLoop &loop, MdnsCache &cache, SendFn send)
+    : m_loop(loop), m_cache(cache), m_send(send),
+      m_epoch(clock::now()), m_rand((unsigned)clock::now().time_since_epoch().count()),
+      m_initial(), m_timer(0), m_alive(std::make_shared<bool>(true)), m_packets(0), m_questions(0) {
+}
+
+MdnsScheduler::~MdnsScheduler() {
+    if (m_timer) {
+        m_loop.cancelTimer(m_timer);
+    }
+}
+
+std::string_view
+MdnsScheduler::queryKey(mdns_recordtype type, std::string_view name, char *buf) {
+    buf[0] = (char)((unsigned)type >> 8);
+    buf[1] = (char)type;
+    mdns_string_t k = mdns_string_key(name.data(), name.size(), buf+2, kKeyMax-2);
+    return std::string_view(buf, 2 + k.length);
+}
+
+bool
+MdnsScheduler::add(mdns_recordtype type, const std::string &name) {
+    {
+        char buf[kKeyMax];
+        std::string_view key = queryKey(type, name, buf);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_queries.find(key) != m_queries.end()) {
+            return false;
+        }
+        Query &q = m_queries[std::string(key)];
+        q.type = type;
+        q.name = name;
+        q.interval = kFirstInterval;
+        // queries added together share the first delay, so their backoff stays in step
+        // and they keep sharing packets
+        auto now = clock::now();
+        if (m_initial <= now) {
+            m_initial = now + std::chrono::milliseconds(20 + m_rand()%101);
+        }
+        q.backoff = m_initial;
+        q.refresh = clock::time_point::max();
+        q.due = clock::time_point::max();
+        q.jitter = (m_rand()%1000) / 50000.0;
+        setDue(q);
+    }
+    std::weak_ptr<bool> alive = m_alive;
+    m_loop.post([this, alive]() {
+            if (alive.lock()) arm();
+        });
+    return true;
+}
+
+bool
+MdnsScheduler::remove(mdns_recordtype type, const std::string &name) {
+    char buf[kKeyMax];
+    std::string_view key = queryKey(type, name, buf);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto qi = m_queries.find(key);
+    if (qi == m_queries.end()) {
+        return false;
+    }
+    m_due.cancel(&qi->second);
+    m_queries.erase(qi);
+    return true; // a timer left for it just finds nothing due
+}
+
+size_t
+MdnsScheduler::size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_queries.size();
+}
+
+// earliest refresh point of any cached answer to q that is later than after; read in
+// place, this runs for every record answering a continuous query
+MdnsScheduler::clock::time_point
+MdnsScheduler::nextRefresh(const Query &q, clock::time_point after) const {
+    clock::time_point next = clock::time_point::max();
+    m_cache.visit(q.type, q.name, [&](const MdnsCache::Entry &e) {
+            if (e.ttl <= 1) {
+                return; // goodbye
+            }
+            auto ttl = std::chrono::duration_cast<clock::duration>(std::chrono::seconds(e.ttl));
+            auto jitter = std::chrono::duration_cast<clock::duration>(ttl * q.jitter);
+            for(unsigned pct : skRefreshPercent) {
+                auto t = e.received + ttl*pct/100 + jitter;
+                if (t > after) {
+                    if (t < next) next = t;
+                    break;
+                }
+            }
+        }, after);
+    return next;
+}
+
+// whole milliseconds since m_epoch: a question may go out up to 1ms early, well within kAggregate
+uint64_t
+MdnsScheduler::ticks(clock::time_point t) const {
+    if (t <= m_epoch) {
+        return 0;
+    }
+    return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(t - m_epoch).count();
+}
+
+// reposition q in m_due after its backoff or refresh time changed; m_mutex held
+void
+MdnsScheduler::setDue(Query &q) {
+    clock::time_point due = q.backoff < q.refresh ? q.backoff : q.refresh;
+    if (due == q.due && q.linked()) {
+        return;
+    }
+    q.due = due;
+    if (due == clock::time_point::max()) {
+        m_due.cancel(&q);
+    } else {
+        m_due.insert(&q, ticks(due));
+    }
+}
+
+void
+MdnsScheduler::onRecord(mdns_recordtype type, std::string_view name) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_queries.empty()) {
+            return;
+        }
+        char buf[kKeyMax];
+        auto qi = m_queries.find(queryKey(type, name, buf));
+        if (qi == m_queries.end()) {
+            return;
+        }
+        qi->second.refresh = nextRefresh(qi->second, clock::now() + kAggregate);
+        setDue(qi->second);
+    }
+    arm();
+}
+
+// keep the one loop timer on the earliest due question
+void
+MdnsScheduler::arm() {
+    clock::time_point next;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        uint64_t t = m_due.next();
+        next = t==MdnsTimerWheel::kNever ? clock::time_point::max() : m_epoch + std::chrono::milliseconds(t);
+    }
+    if (m_timer && m_timerAt == next) {
+        return;
+    }
+    if (m_timer) {
+        m_loop.cancelTimer(m_timer);
+        m_timer = 0;
+    }
+    if (next != clock::time_point::max()) {
+        m_timerAt = next;
+        m_timer = m_loop.addTimer(next, [this]() {
+                m_timer = 0;
+                tick();
+            });
+    }
+}
+
+// send everything due now, or within kAggregate of now, as one query
+void
+MdnsScheduler::tick() {
+    std::vector<MdnsQuestion> questions;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto now = clock::now();
+        auto limit = now + kAggregate;
+        std::vector<Query*> sent;
+        m_due.advance(ticks(limit), [&sent](MdnsTimerWheel::Node *n) {
+                sent.push_back(static_cast<Query*>(n));
+            });
+        for(Query *q : sent) {
+            questions.push_back({ q->type, q->name });
+            if (q->backoff <= limit) {
+                // section 5.2: 1s between the first two, then at least doubling, at most an hour
+                q->backoff = now + q->interval;
+                q->interval *= 2;
+                if (q->interval > kMaxInterval) q->interval = kMaxInterval;
+            }
+            q->refresh = nextRefresh(*q, limit);
+            setDue(*q);
+        }
+    }
+    if (!questions.empty()) {
+        m_send(questions);
+        m_packets++;
+        m_questions += questions.size();
+    }
+    arm();
+}
+
+/*
+ * Local Variables:
+ * mode: C++
+ * mode: font-lock
+ * c-basic-offset: 4
+ * tab-width: 8
+ * compile-command: "make.qmk"
+ * End:
+ */
+
+/* end of /github:elhernes/libmdns/mdns_scheduler.cpp */
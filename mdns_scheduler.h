@@ -0,0 +1,106 @@
+/********************************************************************************
+ * file: /github:elhernes/libmdns/mdns_scheduler.h
+ *
+ * born-on: Sun Oct 18 2026
+ * creator: Eric L. Hernes
+ *
+ * RFC 6762 section 5.2 continuous queries: exponential backoff plus cache
+ * refresh at 80/85/90/95% of TTL, all questions driven by one loop timer
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>    // for size_t
+#include <stdint.h>    // for uint64_t
+#include <atomic>
+#include <chrono>
+#include <functional>  // for function
+#include <map>
+#include <memory>      // for shared_ptr
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "mdns.h"
+#include "mdns_loop.h"
+#include "mdns_wheel.h"
+
+class MdnsCache;
+
+class MdnsScheduler {
+ public:
+    using clock = MdnsLoop::clock;
+    using SendFn = std::function<bool(const std::vector<MdnsQuestion> &questions)>;
+
+    // questions due within this much of each other share a packet
+    static constexpr std::chrono::milliseconds kAggregate{20};
+    static constexpr std::chrono::seconds kFirstInterval{1};
+    static constexpr std::chrono::seconds kMaxInterval{60*60};
+
+    // send is called on the loop thread with every question due at once
+    MdnsScheduler(MdnsLoop &loop, MdnsCache &cache, SendFn send);
+    virtual ~MdnsScheduler();
+
+    // any thread; the first query goes out 20-120ms later (section 5.2), from the loop
+    bool add(mdns_recordtype type, const std::string &name);
+    bool remove(mdns_recordtype type, const std::string &name);
+
+    // loop thread: an answer for (type, name) was cached; reschedules its refresh queries
+    void onRecord(mdns_recordtype type, std::string_view name);
+
+    size_t size() const;
+    uint64_t packets() const { return m_packets; }
+    uint64_t questions() const { return m_questions; }
+
+ protected:
+    struct Query : MdnsTimerWheel::Node {
+        mdns_recordtype type;
+        std::string name;
+        clock::duration interval;    // to the next backoff query
+        clock::time_point backoff;   // next backoff query
+        clock::time_point refresh;   // next cache refresh query, max() for none
+        clock::time_point due;       // min(backoff, refresh): its m_due position
+        double jitter;               // fraction of TTL, 0-2%, added to refresh points
+    };
+
+    // m_queries' key in buf (kKeyMax): the type's two bytes, then MdnsCache::key(name)
+    static const size_t kKeyMax = 2+256;
+    static std::string_view queryKey(mdns_recordtype type, std::string_view name, char *buf);
+    clock::time_point nextRefresh(const Query &q, clock::time_point after) const;
+    uint64_t ticks(clock::time_point t) const;
+    void setDue(Query &q);
+    void arm();
+    void tick();
+
+ protected:
+    MdnsLoop &m_loop;
+    MdnsCache &m_cache;
+    SendFn m_send;
+    mutable std::mutex m_mutex;
+    std::map<std::string, Query, std::less<> > m_queries;
+    clock::time_point m_epoch;  // m_due tick 0
+    MdnsTimerWheel m_due;       // queries by due time, 1ms ticks
+    std::minstd_rand m_rand;
+    clock::time_point m_initial;  // first query time for questions added now
+    // loop thread only
+    MdnsLoop::TimerId m_timer;
+    clock::time_point m_timerAt;
+    std::shared_ptr<bool> m_alive;  // posted work checks this before touching us
+    std::atomic<uint64_t> m_packets;
+    std::atomic<uint64_t> m_questions;
+};
+
+/*
+ * Local Variables:
+ * mode: C++
+ * mode: font-lock
+ * c-basic-offset: 4
+ * tab-width: 8
+ * compile-command: "make.qmk"
+ * End:
+ */
+
+/* end of /github:elhernes/libmdns/mdns_scheduler.h */
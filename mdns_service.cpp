@@ -0,0 +1,233 @@
+/********************************************************************************
+ * file: /github:elhernes/libmdns/mdns_service.cpp
+ *
+ * born-on: Sun Oct 18 2026
+ * creator: Eric L. Hernes
+ *
+ * DNS-SD service resolution
+ *
+ */
+
+#include <stdint.h>  // for uint8_t
+#include <stddef.h>  // for size_t
+
+#include <arpa/inet.h>  // for inet_ntop
+#include <netinet/in.h>
+
+#include <chrono>
+#include <map>
+
+#include "mdns_service.h"
+#include "mdns_c.h"
+#include "mdns_cache.h"
+
+namespace {
+    using clock = MdnsCache::clock;
+    const int skSliceMs = 50;  // receive between looks at the cache
+
+    // one question's send times: repeated kRetryMs after the first, then twice as long
+    // each time, as RFC 6762 section 5.2 has it
+    struct Asked {
+        clock::time_point at;  // epoch: never
+        int intervalMs = MdnsServiceResolver::kRetryMs;
+
+        bool never() const { return at == clock::time_point(); }
+        bool due(clock::time_point now) const {
+            return never() || now - at >= std::chrono::milliseconds(intervalMs);
+        }
+        void sent(clock::time_point now) {
+            if (!never()) intervalMs *= 2;
+            at = now;
+        }
+    };
+
+    struct Instance {
+        MdnsService svc;
+        bool haveSrv = false;
+        bool haveTxt = false;
+        Asked srvAsked;
+        Asked txtAsked;
+    };
+
+    struct Host {
+        std::vector<std::string> addresses;
+        Asked asked;
+    };
+
+    // rdata as cached: wire form, names uncompressed
+    std::string ptrName(const std::string &rdata) {
+        char namebuffer[256];
+        mdns_string_t name = mdns_record_parse_ptr((const uint8_t*)rdata.data(), rdata.size(), 0, rdata.size(),
+                                                   namebuffer, sizeof(namebuffer));
+        return std::string(name.str ? name.str : "", name.length);
+    }
+
+    bool parseSrv(const std::string &rdata, MdnsService &svc) {
+        char namebuffer[256];
+        mdns_record_srv_t srv = mdns_record_parse_srv((const uint8_t*)rdata.data(), rdata.size(), 0, rdata.size(),
+                                                      namebuffer, sizeof(namebuffer));
+        if (srv.name.length == 0) {
+            return false;
+        }
+        svc.host.assign(srv.name.str, srv.name.length);
+        svc.priority = srv.priority;
+        svc.weight = srv.weight;
+        svc.port = srv.port;
+        return true;
+    }
+
+    // each character-string whole, so boolean attributes (no '=') survive
+    void parseTxt(const std::string &rdata, std::vector<std::string> &txt) {
+        txt.clear();
+        size_t i=0;
+        while (i < rdata.size()) {
+            size_t n = (uint8_t)rdata[i++];
+            if (n > rdata.size()-i) {
+                break;
+            }
+            if (n) {
+                txt.emplace_back(rdata, i, n);
+            }
+            i += n;
+        }
+    }
+
+    void addAddress(int family, const std::string &rdata, std::vector<std::string> &v) {
+        char buf[INET6_ADDRSTRLEN];
+        if (inet_ntop(family, rdata.data(), buf, sizeof(buf))) {
+            v.emplace_back(buf);
+        }
+    }
+}
+
+const int MdnsServiceResolver::kRetryMs;
+const int MdnsServiceResolver::kQuietMs;
+
+MdnsServiceResolver::MdnsServiceResolver(MdnsRR &rr) : m_rr(rr), m_stats() {
+}
+
+bool
+MdnsServiceResolver::resolve(const std::string &type, std::vector<MdnsService> &v, int msec) {
+    MdnsCache &cache = m_rr.cache();
+    std::map<std::string, Instance> instances; // by cache key
+    std::map<std::string, Host> hosts;
+    auto start = clock::now();
+    auto deadline = start + std::chrono::milliseconds(msec);
+    Asked ptrAsked;
+    clock::time_point lastNew = start;
+    std::vector<MdnsQuestion> questions;
+    MdnsRecordBatch batch;
+
+    for(;;) {
+        auto now = clock::now();
+
+        // what we have: everything parsed so far, additional records included, is cached
+        cache.visit(mdns_recordtype::PTR, type, [&](const MdnsCache::Entry &e) {
+                std::string name = ptrName(e.rdata);
+                if (!name.empty()) {
+                    Instance &in = instances[MdnsCache::key(name)];
+                    if (in.svc.instance.empty()) {
+                        in.svc.instance = name;
+                        lastNew = now;
+                    }
+                }
+            }, now);
+        bool complete = true;
+        for(auto &ii : instances) {
+            Instance &in = ii.second;
+            if (!in.haveSrv) {
+                cache.visit(mdns_recordtype::SRV, in.svc.instance, [&in](const MdnsCache::Entry &e) {
+                        if (!in.haveSrv) in.haveSrv = parseSrv(e.rdata, in.svc);
+                    }, now);
+                if (in.haveSrv && in.srvAsked.never()) m_stats.additional++;
+            }
+            if (!in.haveTxt) {
+                cache.visit(mdns_recordtype::TXT, in.svc.instance, [&in](const MdnsCache::Entry &e) {
+                        if (!in.haveTxt) {
+                            parseTxt(e.rdata, in.svc.txt);
+                            in.haveTxt = true;
+                        }
+                    }, now);
+                if (in.haveTxt && in.txtAsked.never()) m_stats.additional++;
+            }
+            if (in.haveSrv) {
+                Host &h = hosts[MdnsCache::key(in.svc.host)];
+                if (h.addresses.empty()) {
+                    cache.visit(mdns_recordtype::A, in.svc.host, [&h](const MdnsCache::Entry &e) {
+                            if (e.rdata.size() == 4) addAddress(AF_INET, e.rdata, h.addresses);
+                        }, now);
+                    cache.visit(mdns_recordtype::AAAA, in.svc.host, [&h](const MdnsCache::Entry &e) {
+                            if (e.rdata.size() == 16) addAddress(AF_INET6, e.rdata, h.addresses);
+                        }, now);
+                    if (!h.addresses.empty() && h.asked.never()) m_stats.additional++;
+                }
+                in.svc.addresses = h.addresses;
+            }
+            complete = complete && in.haveSrv && in.haveTxt && !in.svc.addresses.empty();
+        }
+
+        // every instance complete: only waiting out the quiet period, no more browsing
+        bool settled = complete && !instances.empty();
+        auto quiet = std::chrono::milliseconds(kQuietMs);
+        if (now >= deadline ||
+            (settled && now - lastNew >= quiet && now - ptrAsked.at >= quiet)) {
+            break;
+        }
+
+        // what we lack: one packet of questions covering every instance
+        questions.clear();
+        if (!settled && ptrAsked.due(now)) {
+            questions.push_back({ mdns_recordtype::PTR, type });
+            ptrAsked.sent(now);
+        }
+        for(auto &ii : instances) {
+            Instance &in = ii.second;
+            if (!in.haveSrv && in.srvAsked.due(now)) {
+                questions.push_back({ mdns_recordtype::SRV, in.svc.instance });
+                in.srvAsked.sent(now);
+            }
+            if (!in.haveTxt && in.txtAsked.due(now)) {
+                questions.push_back({ mdns_recordtype::TXT, in.svc.instance });
+                in.txtAsked.sent(now);
+            }
+            if (in.haveSrv) {
+                Host &h = hosts[MdnsCache::key(in.svc.host)];
+                if (h.addresses.empty() && h.asked.due(now)) {
+                    questions.push_back({ mdns_recordtype::A, in.svc.host });
+                    questions.push_back({ mdns_recordtype::AAAA, in.svc.host });
+                    h.asked.sent(now);
+                }
+            }
+        }
+        if (!questions.empty()) {
+            m_rr.query(questions);
+            m_stats.queries++;
+            m_stats.questions += questions.size();
+        }
+
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count();
+        batch.clear();
+        m_rr.responses(batch, (int)(left < skSliceMs ? left : skSliceMs));
+    }
+
+    size_t n = v.size();
+    for(auto &ii : instances) {
+        Instance &in = ii.second;
+        if (in.haveSrv && in.haveTxt && !in.svc.addresses.empty()) {
+            v.push_back(in.svc);
+        }
+    }
+    return v.size() > n;
+}
+
+/*
+ * Local Variables:
+ * mode: C++
+ * mode: font-lock
+ * c-basic-offset: 4
+ * tab-width: 8
+ * compile-command: "make.qmk"
+ * End:
+ */
+
+/* end of /github:elhernes/libmdns/mdns_service.cpp */
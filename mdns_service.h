@@ -0,0 +1,70 @@
+/********************************************************************************
+ * file: /github:elhernes/libmdns/mdns_service.h
+ *
+ * born-on: Sun Oct 18 2026
+ * creator: Eric L. Hernes
+ *
+ * DNS-SD service resolution: PTR -> SRV + TXT -> A/AAAA for every instance of
+ * a service type.  Records responders volunteer in the additional section
+ * land in the cache with the answers, so only the pieces still missing after
+ * each packet are asked for, all instances' questions sharing a packet.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>    // for uint16_t, uint64_t
+#include <string>
+#include <vector>
+
+#include "mdns.h"
+
+struct MdnsService {
+    std::string instance;                // "My Box._ssh._tcp.local."
+    std::string host;                    // SRV target, "box.local."
+    uint16_t priority = 0;
+    uint16_t weight = 0;
+    uint16_t port = 0;
+    std::vector<std::string> addresses;  // numeric, IPv4 first
+    std::vector<std::string> txt;        // "key=value", or "key" for a boolean attribute
+};
+
+struct MdnsServiceStats {
+    uint64_t queries;    // packets sent
+    uint64_t questions;  // questions in them
+    uint64_t additional; // pieces already in the cache, mostly from additional records, when first looked for
+};
+
+class MdnsServiceResolver {
+ public:
+    // a question is repeated kRetryMs after it was first sent, then at doubling intervals,
+    // until answered; the browse (PTR) stops once every instance is complete, and resolve()
+    // returns early when none have turned up for kQuietMs after that
+    static const int kRetryMs = 1000;
+    static const int kQuietMs = 250;
+
+    explicit MdnsServiceResolver(MdnsRR &rr);
+
+    // every instance of type (e.g. "_ssh._tcp.local") heard of within msec, with its host,
+    // port, addresses and TXT; only complete services are returned. Runs the receive loop
+    // like MdnsRR::resolve(), so not while rr is start()ed.
+    bool resolve(const std::string &type, std::vector<MdnsService> &v, int msec);
+
+    const MdnsServiceStats &stats() const { return m_stats; }
+
+ private:
+    MdnsRR &m_rr;
+    MdnsServiceStats m_stats;
+};
+
+/*
+ * Local Variables:
+ * mode: C++
+ * mode: font-lock
+ * c-basic-offset: 4
+ * tab-width: 8
+ * compile-command: "make.qmk"
+ * End:
+ */
+
+/* end of /github:elhernes/libmdns/mdns_service.h */
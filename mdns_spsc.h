@@ -0,0 +1,117 @@
+/********************************************************************************
+ * file: /github:elhernes/libmdns/mdns_spsc.h
+ *
+ * born-on: Sun Oct 18 2026
+ * creator: Eric L. Hernes
+ *
+ * Bounded lock-free single-producer/single-consumer ring.  Slots are
+ * constructed once and reused in place, so a producer that fills a slot
+ * (rather than copying into it) never allocates in steady state, and a full
+ * ring drops instead of blocking the producer.
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>    // for size_t
+#include <stdint.h>    // for uint64_t
+#include <atomic>
+#include <vector>
+
+template<typename T>
+class MdnsSpsc {
+ public:
+    // capacity is rounded up to a power of two
+    explicit MdnsSpsc(size_t capacity=64)
+        : m_head(0), m_cachedTail(0), m_tail(0), m_cachedHead(0), m_drops(0) {
+        size_t n=1;
+        while (n<capacity) n<<=1;
+        m_slots.resize(n);
+        m_mask = n-1;
+    }
+
+    MdnsSpsc(const MdnsSpsc &) = delete;
+    MdnsSpsc &operator=(const MdnsSpsc &) = delete;
+
+    // producer: the next free slot to fill in place, nullptr when the ring is full
+    T *prepare() {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head - m_cachedTail > m_mask) {
+            m_cachedTail = m_tail.load(std::memory_order_acquire);
+            if (head - m_cachedTail > m_mask) {
+                return nullptr;
+            }
+        }
+        return &m_slots[head & m_mask];
+    }
+
+    // producer: publish the slot returned by prepare()
+    void commit() {
+        m_head.store(m_head.load(std::memory_order_relaxed)+1, std::memory_order_release);
+    }
+
+    // producer: copy v in; false, counting a drop, when full
+    bool push(const T &v) {
+        T *slot = prepare();
+        if (!slot) {
+            drop();
+            return false;
+        }
+        *slot = v;
+        commit();
+        return true;
+    }
+
+    // producer: account for n items that did not fit
+    void drop(uint64_t n=1) { m_drops.fetch_add(n, std::memory_order_relaxed); }
+
+    // consumer: f(T &) on up to max published slots, oldest first, then release
+    // them all at once; returns how many were consumed
+    template<typename F>
+    size_t consume(F f, size_t max=(size_t)-1) {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (m_cachedHead == tail) {
+            m_cachedHead = m_head.load(std::memory_order_acquire);
+        }
+        size_t n = m_cachedHead - tail;
+        if (n>max) n=max;
+        for(size_t i=0; i<n; i++) {
+            f(m_slots[(tail+i) & m_mask]);
+        }
+        if (n>0) {
+            m_tail.store(tail+n, std::memory_order_release);
+        }
+        return n;
+    }
+
+    // approximate when called from either side while the other is running
+    size_t size() const {
+        return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+    }
+    bool empty() const { return size()==0; }
+    size_t capacity() const { return m_mask+1; }
+    uint64_t drops() const { return m_drops.load(std::memory_order_relaxed); }
+
+ private:
+    std::vector<T> m_slots;
+    size_t m_mask;
+    // producer side
+    alignas(64) std::atomic<size_t> m_head;
+    size_t m_cachedTail;
+    // consumer side
+    alignas(64) std::atomic<size_t> m_tail;
+    size_t m_cachedHead;
+    alignas(64) std::atomic<uint64_t> m_drops;
+};
+
+/*
+ * Local Variables:
+ * mode: C++
+ * mode: font-lock
+ * c-basic-offset: 4
+ * tab-width: 8
+ * compile-command: "make.qmk"
+ * End:
+ */
+
+/* end of /github:elhernes/libmdns/mdns_spsc.h */
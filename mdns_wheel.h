@@ -0,0 +1,241 @@
+/********************************************************************************
+ * file: /github:elhernes/libmdns/mdns_wheel.h
+ *
+ * born-on: Sun Oct 18 2026
+ * creator: Eric L. Hernes
+ *
+ * Hierarchical timer wheel (Varghese & Lauck): four levels of 64 slots plus
+ * an overflow list, O(1) insert and cancel of intrusive nodes, and a per-level
+ * occupancy bitmap so the next deadline is found without scanning slots.
+ * Time is in caller-defined integer ticks.
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>    // for size_t
+#include <stdint.h>    // for uint64_t
+
+class MdnsTimerWheel {
+ public:
+    static const unsigned kBits = 6;
+    static const unsigned kSlots = 1u<<kBits;
+    static const unsigned kLevels = 4;
+    static const uint64_t kNever = ~(uint64_t)0;
+
+    // embed (or derive from) one of these per timer; copies start out unlinked
+    struct Node {
+        Node() : prev(nullptr), next(nullptr), expires(0) {}
+        Node(const Node &) : prev(nullptr), next(nullptr), expires(0) {}
+        Node &operator=(const Node &) { return *this; }
+        bool linked() const { return next!=nullptr; }
+
+        Node *prev;
+        Node *next;
+        uint64_t expires;  // tick
+    };
+
+    explicit MdnsTimerWheel(uint64_t now=0) : m_now(now), m_size(0) {
+        for(unsigned l=0; l<kLevels; l++) {
+            m_used[l] = 0;
+            for(unsigned s=0; s<kSlots; s++) {
+                init(&m_slots[l][s]);
+            }
+        }
+        init(&m_ready);
+        init(&m_overflow);
+    }
+
+    MdnsTimerWheel(const MdnsTimerWheel &) = delete;
+    MdnsTimerWheel &operator=(const MdnsTimerWheel &) = delete;
+
+    // (re)schedule n to fire once advance() reaches expires; in the past means next advance()
+    void insert(Node *n, uint64_t expires) {
+        if (n->linked()) cancel(n);
+        n->expires = expires<kNever ? expires : kNever-1; // kNever marks list heads
+        place(n);
+        m_size++;
+    }
+
+    void cancel(Node *n) {
+        if (!n->linked()) {
+            return;
+        }
+        Node *head = n->next==n->prev && n->next->expires==kNever ? n->next : nullptr;
+        unlink(n);
+        m_size--;
+        if (head) clearBit(head);
+    }
+
+    // fire(Node *) on every node due by tick now, each unlinked before its call; fire may
+    // insert and cancel freely. Returns how many fired.
+    template<typename F>
+    size_t advance(uint64_t now, F fire) {
+        size_t fired=0;
+        fired += drain(&m_ready, fire);
+        while (m_size>0) {
+            uint64_t t = nextEvent();
+            if (t > now) {
+                break;
+            }
+            m_now = t;
+            // cascade from the top so a timer moves down as far as it can in one go
+            if ((t & ((1ull<<(kBits*kLevels))-1)) == 0) {
+                cascade(&m_overflow);
+            }
+            for(unsigned l=kLevels-1; l>0; l--) {
+                if ((t & ((1ull<<(kBits*l))-1)) == 0) {
+                    unsigned s = (unsigned)(t >> (kBits*l)) & (kSlots-1);
+                    if (m_used[l] & (1ull<<s)) {
+                        m_used[l] &= ~(1ull<<s);
+                        cascade(&m_slots[l][s]);
+                    }
+                }
+            }
+            unsigned s = (unsigned)t & (kSlots-1);
+            if (m_used[0] & (1ull<<s)) {
+                m_used[0] &= ~(1ull<<s);
+                fired += drain(&m_slots[0][s], fire);
+            }
+            fired += drain(&m_ready, fire); // inserted in the past by fire()
+        }
+        if (now > m_now) m_now = now;
+        return fired;
+    }
+
+    // tick by which advance() has something to do: exact for timers due within a level-0
+    // revolution, otherwise the cascade that brings the earliest timer closer; kNever if empty
+    uint64_t next() const {
+        return m_size>0 ? nextEvent() : kNever;
+    }
+
+    uint64_t now() const { return m_now; }
+    size_t size() const { return m_size; }
+
+ private:
+    // list heads are sentinels marked with expires==kNever; their bitmap position is
+    // recovered from their address
+    static void init(Node *head) {
+        head->prev = head->next = head;
+        head->expires = kNever;
+    }
+
+    static void unlink(Node *n) {
+        n->prev->next = n->next;
+        n->next->prev = n->prev;
+        n->prev = n->next = nullptr;
+    }
+
+    static void append(Node *head, Node *n) {
+        n->prev = head->prev;
+        n->next = head;
+        head->prev->next = n;
+        head->prev = n;
+    }
+
+    void clearBit(Node *head) {
+        for(unsigned l=0; l<kLevels; l++) {
+            if (head >= &m_slots[l][0] && head < &m_slots[l][kSlots]) {
+                m_used[l] &= ~(1ull << (head - &m_slots[l][0]));
+                return;
+            }
+        }
+    }
+
+    void place(Node *n) {
+        if (n->expires <= m_now) {
+            append(&m_ready, n);
+            return;
+        }
+        uint64_t delta = n->expires - m_now;
+        for(unsigned l=0; l<kLevels; l++) {
+            if (delta < (1ull << (kBits*(l+1)))) {
+                unsigned s = (unsigned)(n->expires >> (kBits*l)) & (kSlots-1);
+                append(&m_slots[l][s], n);
+                m_used[l] |= 1ull<<s;
+                return;
+            }
+        }
+        append(&m_overflow, n);
+    }
+
+    // detach the list first: overflow nodes still far out go straight back onto it
+    void cascade(Node *head) {
+        if (head->next == head) {
+            return;
+        }
+        Node list;
+        list.next = head->next;
+        list.prev = head->prev;
+        list.next->prev = list.prev->next = &list;
+        head->next = head->prev = head;
+        while (list.next != &list) {
+            Node *n = list.next;
+            unlink(n);
+            place(n);
+        }
+    }
+
+    template<typename F>
+    size_t drain(Node *head, F &fire) {
+        size_t fired=0;
+        while (head->next != head) {
+            Node *n = head->next;
+            unlink(n);
+            m_size--;
+            fired++;
+            fire(n);
+        }
+        return fired;
+    }
+
+    // the next tick with a slot to fire or cascade
+    uint64_t nextEvent() const {
+        if (m_ready.next != &m_ready) {
+            return m_now;
+        }
+        uint64_t best = kNever;
+        for(unsigned l=0; l<kLevels; l++) {
+            if (!m_used[l]) {
+                continue;
+            }
+            unsigned shift = kBits*l;
+            unsigned cur = (unsigned)(m_now >> shift) & (kSlots-1);
+            uint64_t base = (m_now >> (shift+kBits)) << (shift+kBits);
+            uint64_t later = cur+1<kSlots ? m_used[l] & (~0ull << (cur+1)) : 0;
+            uint64_t t;
+            if (later) {
+                t = base + ((uint64_t)__builtin_ctzll(later) << shift);
+            } else {
+                // wrapped: the slot comes round after this level's revolution
+                t = base + (1ull << (shift+kBits)) + ((uint64_t)__builtin_ctzll(m_used[l]) << shift);
+            }
+            if (t < best) best = t;
+        }
+        if (m_overflow.next != &m_overflow) {
+            uint64_t t = ((m_now >> (kBits*kLevels)) + 1) << (kBits*kLevels);
+            if (t < best) best = t;
+        }
+        return best;
+    }
+
+ private:
+    uint64_t m_now;     // last tick advanced to
+    size_t m_size;
+    uint64_t m_used[kLevels];
+    Node m_slots[kLevels][kSlots];
+    Node m_ready;
+    Node m_overflow;
+};
+
+/*
+ * Local Variables:
+ * mode: C++
+ * mode: font-lock
+ * c-basic-offset: 4
+ * tab-width: 8
+ * compile-command: "make.qmk"
+ * End:
+ */
+
+/* end of /github:elhernes/libmdns/mdns_wheel.h */
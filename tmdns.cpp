@@ -11,9 +11,17 @@
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
+#include <stdlib.h>
 
 #include "mdns.h"
+#include "mdns_responder.h"
+#include "mdns_cache.h"
+#include "mdns_pcap.h"
+#include "mdns_scheduler.h"
+#include "mdns_service.h"
 
+#include <atomic>
+#include <chrono>
 #include <map>
 #include <future>
 #include <unistd.h>
@@ -52,6 +60,134 @@ const std::map<std::string, std::function<bool(MdnsRR &mdns, const std::vector<s
             return rv;
         } },
 
+    { "publish", [](MdnsRR &mdns, const std::vector<std::string> &av) ->bool {
+            if (av.size()<4) {
+                usage();
+                return false;
+            }
+            char host[256];
+            gethostname(host, sizeof(host)-7);
+            host[sizeof(host)-7]='\0';
+            strcat(host, ".local");
+            MdnsResponder responder;
+            responder.addHost(host);
+            responder.addService(av[1], av[2], host, (uint16_t)atoi(av[3].c_str()),
+                                 std::vector<std::string>(av.begin()+4, av.end()));
+            responder.compile();
+            printf("Publishing %s.%s on %s:%s (%lu response packets)\n", av[1].c_str(), av[2].c_str(),
+                   host, av[3].c_str(), responder.packets());
+            responder.run(60*1000);
+            auto &st = responder.stats();
+            printf("%lu queries, %lu questions, %lu answered, %lu unknown, %lu suppressed, %lu throttled, %lu aggregated\n",
+                   st.queries, st.questions, st.answered, st.unknown, st.suppressed, st.throttled,
+                   st.aggregated);
+            return false;
+        } },
+
+    { "browse", [](MdnsRR &mdns, const std::vector<std::string> &av) ->bool {
+            if (av.size()<2) {
+                usage();
+                return false;
+            }
+            int secs = av.size()>2 ? atoi(av[2].c_str()) : 60;
+            mdns.subscribe("", mdns_recordtype::IGNORE, [](const MdnsRecordView &r) {
+                    printf("%.*s %.*s? %.*s\n", (int)r.ip.size(), r.ip.data(),
+                           (int)r.question.size(), r.question.data(), (int)r.data.size(), r.data.data());
+                });
+            mdns.continuousQuery(mdns_recordtype::PTR, av[1]);
+            mdns.start();
+            sleep(secs);
+            mdns.stop();
+            auto &sc = mdns.scheduler();
+            printf("%lu query packets, %lu questions\n", sc.packets(), sc.questions());
+            return false;
+        } },
+
+    { "resolve", [](MdnsRR &mdns, const std::vector<std::string> &av) ->bool {
+            if (av.size()<2) {
+                usage();
+                return false;
+            }
+            int msec = av.size()>2 ? atoi(av[2].c_str()) : 3000;
+            MdnsServiceResolver resolver(mdns);
+            std::vector<MdnsService> services;
+            resolver.resolve(av[1], services, msec);
+            for(auto &s : services) {
+                printf("%s %s:%u", s.instance.c_str(), s.host.c_str(), s.port);
+                for(auto &a : s.addresses) {
+                    printf(" %s", a.c_str());
+                }
+                for(auto &t : s.txt) {
+                    printf(" \"%s\"", t.c_str());
+                }
+                printf("\n");
+            }
+            auto &st = resolver.stats();
+            printf("%lu services, %lu query packets, %lu questions, %lu pieces from additional records\n",
+                   services.size(), st.queries, st.questions, st.additional);
+            return false;
+        } },
+
+    { "metrics", [](MdnsRR &mdns, const std::vector<std::string> &av) ->bool {
+            int secs = av.size()>1 ? atoi(av[1].c_str()) : 2;
+            mdns.discover();
+            std::vector<MdnsRecord> rsp;
+            mdns.responses(rsp, secs*1000);
+            std::string out;
+            mdns.writeMetrics(out);
+            fputs(out.c_str(), stdout);
+            return false;
+        } },
+
+    { "replay", [](MdnsRR &mdns, const std::vector<std::string> &av) ->bool {
+            if (av.size()<2) {
+                usage();
+                return false;
+            }
+            bool stats = av.size()>2 && av[2]=="stats";
+            MdnsPcap pcap;
+            if (!pcap.open(av[1])) {
+                printf("%s: %s\n", av[1].c_str(), pcap.error().c_str());
+                return false;
+            }
+            MdnsRecordBatch batch;
+            MdnsPcapPacket pkt;
+            uint64_t records=0;
+            std::map<unsigned, uint64_t> types;
+            auto t0 = std::chrono::steady_clock::now();
+            while (pcap.next(pkt)) {
+                batch.clear();
+                records += mdns.parse((const struct sockaddr*)&pkt.from, pkt.payload, pkt.length, batch);
+                for(auto &r : batch.records) {
+                    if (stats) {
+                        types[r.rtype]++;
+                    } else {
+                        printf("%llu.%06llu %.*s %.*s? %.*s\n",
+                               (unsigned long long)(pkt.ns/1000000000), (unsigned long long)(pkt.ns%1000000000)/1000,
+                               (int)r.ip.size(), r.ip.data(), (int)r.question.size(), r.question.data(),
+                               (int)r.data.size(), r.data.data());
+                    }
+                }
+            }
+            double dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+            if (!pcap.error().empty()) {
+                printf("%s: %s\n", av[1].c_str(), pcap.error().c_str());
+            }
+            if (stats) {
+                auto &ps = pcap.stats();
+                auto &rs = mdns.rxStats();
+                printf("frames %lu, mdns %lu, other %lu, fragments %lu, truncated %lu, unknown link %lu\n",
+                       ps.frames, ps.mdns, ps.other, ps.fragments, ps.truncated, ps.linktype);
+                printf("records %lu, queries/rejected %lu, malformed %lu\n", records, rs.rejected, rs.malformed);
+                for(auto &t : types) {
+                    printf(" type %u: %lu\n", t.first, t.second);
+                }
+                printf("cache %lu entries\n", mdns.cache().size());
+                printf("%.3f s, %.0f packets/s, %.0f records/s\n", dt, ps.mdns/dt, records/dt);
+            }
+            return false;
+        } },
+
     { "help", [](MdnsRR &mdns, const std::vector<std::string> &av) ->bool {
             usage();
             return false;
@@ -59,15 +195,20 @@ const std::map<std::string, std::function<bool(MdnsRR &mdns, const std::vector<s
 
     { "async", [](MdnsRR &mdns, const std::vector<std::string> &av) ->bool {
             bool rv=false;
-            bool done=false;
+            std::atomic<bool> done(false);
+            MdnsRecordQueue queue(16);
             std::vector<MdnsRecord> responses;
-            
-            auto arv = std::async(std::launch::async, [&mdns, &done, &responses]() -> int {
-                    for(;!done;) {
-                        mdns.responses(responses, 1000);
-                    }
-                    return 0;
+
+            auto arv = std::async(std::launch::async, [&mdns, &done, &queue]() -> int {
+                    return mdns.receive(queue, done) ? 0 : 1;
                 });
+            auto drain = [&queue, &responses]() {
+                queue.consume([&responses](MdnsRecordBatch &batch) {
+                        for(auto &rv : batch.records) {
+                            responses.emplace_back(rv);
+                        }
+                    });
+            };
 
             static const std::map<std::string,mdns_recordtype> skQueryType = {
                 { "discover", mdns_recordtype::IGNORE }, 
@@ -77,6 +218,7 @@ const std::map<std::string, std::function<bool(MdnsRR &mdns, const std::vector<s
                 { "text", mdns_recordtype::TXT }, 
             };
 
+            std::vector<MdnsQuestion> questions;
             for(auto q=av.begin()+1; q!=av.end(); q++) {
                 auto dd = q->find_first_of(":", 0);
                 auto qtype = skQueryType.find(q->substr(0,dd));
@@ -91,7 +233,7 @@ const std::map<std::string, std::function<bool(MdnsRR &mdns, const std::vector<s
                         //                    case mdns_recordtype::PTR:
                         //                    case mdns_recordtype::TXT:
                         printf("mdns.query(%d, %s)\n", qtype->second, q->substr(dd+1).c_str());
-                        mdns.query(qtype->second, q->substr(dd+1));
+                        questions.push_back({ qtype->second, q->substr(dd+1) });
                         break;
                     }
                     //                    usleep(1000);
@@ -99,12 +241,20 @@ const std::map<std::string, std::function<bool(MdnsRR &mdns, const std::vector<s
                     printf("%s: unknown query type\n", q->substr(0,dd).c_str());
                 }
             }
+            if (questions.size()>0) {
+                mdns.query(questions);
+            }
 
+            auto until = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+            while (std::chrono::steady_clock::now() < until) {
+                drain();
+                usleep(10*1000);
+            }
             done=true;
-            auto status = arv.wait_for(std::chrono::milliseconds(5*1000));
-            int32_t arr=(status == std::future_status::ready);
+            arv.wait();
+            drain();
 
-            printf("got %lu responses\n", responses.size());
+            printf("got %lu responses (%lu dropped)\n", responses.size(), queue.drops());
             for(auto r : responses) {
                 printf("%s %s? %s\n", r.ip.c_str(), r.question.c_str(), r.data.c_str());
             }
@@ -128,7 +278,6 @@ int
 main(int ac, char **av) {
     //    const char *netif= ac==1? "" :av[1];
     const char *netif="wlan0";
-    MdnsRR mdns(netif);
 
     skProg=av[0];
     if (ac<2) {
@@ -137,6 +286,9 @@ main(int ac, char **av) {
     }
 
     std::string cmd=av[1];
+    // replay is offline: no sockets, no groups joined
+    std::unique_ptr<MdnsRR> rr(cmd=="replay" ? new MdnsRR(MdnsRR::NoInterfaces()) : new MdnsRR(netif));
+    MdnsRR &mdns = *rr;
     std::vector<std::string> argv;
     for(int i=1; i<ac; i++) {
         argv.push_back(av[i]);
@@ -174,7 +326,12 @@ usage() {
     static const std::vector<const char *> skExamples = {
         "discover",
         "service _ssh._tcp.local",
+        "browse _ssh._tcp.local 30",
+        "resolve _ssh._tcp.local 3000",
         "host hostname.local",
+        "publish MyBox _ssh._tcp.local 22 user=me",
+        "metrics 5",
+        "replay capture.pcapng stats",
         "discover",
     };
     printf("\nexamples:\n");
@@ -7,7 +7,7 @@
 ##
 
 PROG=tmdns
-SRCS=tmdns.cpp
+SRCS=tmdns.cpp mdns_pcap.cpp
 
 CXXFLAGS-dey=-pthread
 LDFLAGS-dey=-pthread